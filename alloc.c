@@ -0,0 +1,246 @@
+/* alloc.c
+ * 
+ * Copyright (C) 2024 L. Bertini
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#include "spinner.h"
+#include "error.h"
+
+#define SPNR_LINE 64
+#define SPNR_HUGE_PAGE (2 * 1024 * 1024)
+
+/* Every block handed out by malloc_err is preceded by one cache line
+ * holding this header, so that blocks start on a cache line and
+ * free_err knows whether a block lives in an arena (nothing to do, the
+ * arena is released as a whole) or on the heap. */
+
+typedef union
+{
+  spnr_arena_t *arena;
+  char pad[SPNR_LINE];
+} block_hdr_t;
+
+enum
+{
+  ARENA_HEAP = 0,
+  ARENA_MMAP = 1,
+  ARENA_HOOK = 2
+};
+
+struct spnr_arena_struct
+{
+  char *base;
+  size_t capacity;
+  size_t used;
+  int source;
+  int warned;
+  spnr_alloc_hook_t hook;
+};
+
+static _Thread_local spnr_arena_t *current = NULL;
+
+static size_t
+round_up (size_t const size, size_t const align)
+{
+  return (size + align - 1) / align * align;
+}
+
+static void *
+heap_alloc (size_t const size)
+{
+  void *p;
+
+  if (posix_memalign (&p, SPNR_LINE, size))
+    return NULL;
+  return p;
+}
+
+static void *
+arena_take (spnr_arena_t * const arena, size_t const size)
+{
+  void *p;
+
+  if (arena->used + size > arena->capacity)
+    {
+      if (!arena->warned)
+        spnr_warn (SPNR_ERROR_ALLOC, "arena full, falling back to the heap");
+      arena->warned = SPNR_TRUE;
+      return NULL;
+    }
+
+  p = arena->base + arena->used;
+  arena->used += size;
+  return p;
+}
+
+void *
+malloc_err (size_t const size)
+{
+  size_t const total = SPNR_LINE + round_up (size, SPNR_LINE);
+  block_hdr_t *hdr = NULL;
+
+  if (current)
+    hdr = arena_take (current, total);
+  if (hdr)
+    hdr->arena = current;
+  else
+    {
+      hdr = heap_alloc (total);
+      if (!hdr)
+        spnr_err (SPNR_ERROR_ALLOC, "malloc returned NULL");
+      hdr->arena = NULL;
+    }
+
+  return hdr + 1;
+}
+
+void
+free_err (void * const p)
+{
+  block_hdr_t *hdr;
+
+  if (!p)
+    return;
+  hdr = (block_hdr_t *) p - 1;
+  if (!hdr->arena)
+    free (hdr);
+}
+
+/* Arena allocator
+ *
+ * One block reserved up front and carved into cache line aligned pieces
+ * by every allocation the library makes on a thread the arena is bound
+ * to. Large arenas can be backed by huge pages. */
+
+spnr_arena_t *
+spnr_arena_alloc (size_t const capacity, int const flags)
+{
+  spnr_arena_t * const arena = malloc (sizeof (spnr_arena_t));
+  size_t const cap = round_up (capacity, SPNR_LINE);
+
+  if (!arena)
+    spnr_err (SPNR_ERROR_ALLOC, "malloc returned NULL");
+
+  arena->base = NULL;
+  arena->capacity = cap;
+  arena->used = 0;
+  arena->warned = SPNR_FALSE;
+
+#if defined(HAVE_SYS_MMAN_H) && defined(MAP_ANONYMOUS)
+  if (flags & SPNR_ARENA_HUGEPAGES)
+    {
+      void *p = MAP_FAILED;
+
+      arena->capacity = round_up (cap, SPNR_HUGE_PAGE);
+# ifdef MAP_HUGETLB
+      p = mmap (NULL, arena->capacity, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+# endif
+      /* no reserved huge pages: ask for transparent ones */
+      if (p == MAP_FAILED)
+        {
+          p = mmap (NULL, arena->capacity, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+# ifdef MADV_HUGEPAGE
+          if (p != MAP_FAILED)
+            madvise (p, arena->capacity, MADV_HUGEPAGE);
+# endif
+        }
+      if (p != MAP_FAILED)
+        {
+          arena->base = p;
+          arena->source = ARENA_MMAP;
+          return arena;
+        }
+      arena->capacity = cap;
+    }
+#endif
+
+  arena->base = heap_alloc (cap);
+  arena->source = ARENA_HEAP;
+  if (!arena->base)
+    spnr_err (SPNR_ERROR_ALLOC, "cannot allocate the arena");
+
+  return arena;
+}
+
+/* arena whose block comes from hook->alloc, with 64 byte alignment */
+spnr_arena_t *
+spnr_arena_alloc_hook (size_t const capacity,
+                       spnr_alloc_hook_t const * const hook)
+{
+  spnr_arena_t * const arena = malloc (sizeof (spnr_arena_t));
+
+  if (!arena)
+    spnr_err (SPNR_ERROR_ALLOC, "malloc returned NULL");
+
+  arena->capacity = round_up (capacity, SPNR_LINE);
+  arena->used = 0;
+  arena->warned = SPNR_FALSE;
+  arena->source = ARENA_HOOK;
+  arena->hook = *hook;
+  arena->base = hook->alloc (arena->capacity, SPNR_LINE, hook->ctx);
+  if (!arena->base)
+    spnr_err (SPNR_ERROR_ALLOC, "allocator hook returned NULL");
+
+  return arena;
+}
+
+/* releases every object allocated in the arena at once; they must not
+ * be freed individually afterwards */
+void
+spnr_arena_free (spnr_arena_t * const arena)
+{
+  if (current == arena)
+    current = NULL;
+
+  switch (arena->source)
+    {
+#if defined(HAVE_SYS_MMAN_H) && defined(MAP_ANONYMOUS)
+    case ARENA_MMAP:
+      munmap (arena->base, arena->capacity);
+      break;
+#endif
+    case ARENA_HOOK:
+      arena->hook.free (arena->base, arena->capacity, arena->hook.ctx);
+      break;
+    default:
+      free (arena->base);
+    }
+  free (arena);
+}
+
+/* routes the allocations of the calling thread to arena (NULL restores
+ * the heap); returns the previously bound arena */
+spnr_arena_t *
+spnr_arena_bind (spnr_arena_t * const arena)
+{
+  spnr_arena_t * const prev = current;
+  current = arena;
+  return prev;
+}
+
+size_t
+spnr_arena_used (spnr_arena_t const * const arena)
+{
+  return arena->used;
+}
@@ -0,0 +1,307 @@
+/* anneal.c
+ * 
+ * Copyright (C) 2024 L. Bertini
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+#include <math.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "spinner.h"
+#include "error.h"
+#include "rng.h"
+
+/* Population annealing
+ *
+ * A population of R replicas, starting from random configurations, is
+ * equilibrated at the first temperature of the schedule, then cooled
+ * one step at a time. At each step the replicas are reweighted by
+ * exp(-(beta' - beta) N e_r) from their cached energies and resampled
+ * systematically: with tau_r the weights normalized to sum R and C_r
+ * their inclusive prefix sums, replica r is copied into the slots
+ * [floor(C_(r-1) + u), floor(C_r + u)) of the new population, for a
+ * single uniform u. The population size stays R, and both the prefix
+ * sums and the copies run in parallel. The mean weight estimates
+ * Z(beta') / Z(beta).
+ *
+ * Every replica of every step draws from its own stream derived from
+ * the seed, and every thread has its own stepper, so the results do
+ * not depend on the number of threads. */
+
+typedef struct
+{
+  size_t R;
+  spnr_sys_t **pop;
+  spnr_sys_t **next;
+  size_t *family;
+  size_t *next_family;
+  double *e;
+  double *m;
+  double *w;
+  size_t *count;
+  spnr_step_t **steps;
+  size_t n_steps;
+} pa_t;
+
+/* inclusive prefix sums of x in place, by blocks: block sums, their
+ * scan, then the scan inside each block from its offset */
+static void
+prefix_sum (double * const x, size_t const n)
+{
+  size_t b, n_blocks = 1;
+  double *offset;
+
+#ifdef _OPENMP
+  n_blocks = omp_get_max_threads ();
+#endif
+  if (n_blocks > n)
+    n_blocks = n ? n : 1;
+  offset = malloc_err ((n_blocks + 1) * sizeof (double));
+  offset[0] = 0;
+
+#pragma omp parallel for
+  for (b = 0; b < n_blocks; ++b)
+    {
+      size_t i;
+      double s = 0;
+
+      for (i = b * n / n_blocks; i < (b + 1) * n / n_blocks; ++i)
+        s += x[i];
+      offset[b + 1] = s;
+    }
+
+  for (b = 0; b < n_blocks; ++b)
+    offset[b + 1] += offset[b];
+
+#pragma omp parallel for
+  for (b = 0; b < n_blocks; ++b)
+    {
+      size_t i;
+      double s = offset[b];
+
+      for (i = b * n / n_blocks; i < (b + 1) * n / n_blocks; ++i)
+        {
+          s += x[i];
+          x[i] = s;
+        }
+    }
+
+  free_err (offset);
+}
+
+/* n_sweeps sweeps of every replica at temp, then caches e and m */
+static void
+pa_sweep (pa_t * const pa, float const temp, size_t const n_sweeps,
+          unsigned long const seed, size_t const k)
+{
+  size_t r;
+  size_t const R = pa->R;
+
+#pragma omp parallel for schedule (static)
+  for (r = 0; r < R; ++r)
+    {
+      size_t s, t = 0;
+      spnr_sys_t * const sys = pa->pop[r];
+
+#ifdef _OPENMP
+      t = omp_get_thread_num ();
+#endif
+      spnr_rng_seed (spnr_rng_hash (seed, k * R + r));
+      if (k == 0)
+        sys->kind->set_rand (sys->priv, sys->graph->N);
+      for (s = 0; s < n_sweeps; ++s)
+        spnr_step_apply (pa->steps[t], sys, 1 / temp);
+
+      pa->e[r] = spnr_sys_calc_h (sys);
+      pa->m[r] = spnr_sys_calc_phi (sys);
+    }
+}
+
+/* returns ln (Z(beta') / Z(beta)) */
+static double
+pa_resample (pa_t * const pa, double const d_beta, size_t const N,
+             unsigned long const seed, size_t const k)
+{
+  size_t r;
+  size_t const R = pa->R;
+  double e_min = pa->e[0], sum;
+  double const u = spnr_rng_hash_unif (~seed, k);
+  spnr_sys_t **tmp;
+  size_t *tmp_family;
+
+  for (r = 1; r < R; ++r)
+    if (pa->e[r] < e_min)
+      e_min = pa->e[r];
+
+#pragma omp parallel for
+  for (r = 0; r < R; ++r)
+    pa->w[r] = exp (- d_beta * N * (pa->e[r] - e_min));
+
+  prefix_sum (pa->w, R);
+  sum = pa->w[R - 1];
+
+#pragma omp parallel for schedule (dynamic, 64)
+  for (r = 0; r < R; ++r)
+    {
+      size_t j, first, last;
+
+      first = r ? floor (pa->w[r - 1] / sum * R + u) : floor (u);
+      last = floor (pa->w[r] / sum * R + u);
+      if (last > R)
+        last = R;
+      for (j = first; j < last; ++j)
+        {
+          spnr_sys_copy (pa->next[j], pa->pop[r]);
+          pa->next_family[j] = pa->family[r];
+        }
+    }
+
+  tmp = pa->pop;
+  pa->pop = pa->next;
+  pa->next = tmp;
+  tmp_family = pa->family;
+  pa->family = pa->next_family;
+  pa->next_family = tmp_family;
+
+  return - d_beta * N * e_min + log (sum / R);
+}
+
+/* population averages into row k of the table, and the entropy of the
+ * family sizes -sum_f n_f / R ln (n_f / R) */
+static double
+pa_summary (pa_t * const pa, spnr_scan_t * const out, size_t const k,
+            size_t const N)
+{
+  size_t r;
+  size_t const R = pa->R;
+  float const beta = 1 / out->x[k];
+  double h = 0, h2 = 0, m = 0, m2 = 0, m4 = 0, a, p, s = 0;
+
+  for (r = 0; r < R; ++r)
+    {
+      a = fabs (pa->m[r]);
+      h += pa->e[r];
+      h2 += pa->e[r] * pa->e[r];
+      m += a;
+      m2 += a * a;
+      m4 += a * a * a * a;
+    }
+  h /= R;
+  h2 /= R;
+  m /= R;
+  m2 /= R;
+  m4 /= R;
+
+  out->h_mean[k] = h;
+  out->h_var[k] = h2 - h * h;
+  out->phi_mean[k] = m;
+  out->phi_var[k] = m2 - m * m;
+  out->c[k] = beta * beta * N * (h2 - h * h);
+  out->chi[k] = beta * N * (m2 - m * m);
+  out->binder[k] = 1 - m4 / (3 * m2 * m2);
+
+  memset (pa->count, 0, R * sizeof (size_t));
+  for (r = 0; r < R; ++r)
+    ++pa->count[pa->family[r]];
+  for (r = 0; r < R; ++r)
+    if (pa->count[r])
+      {
+        p = (double) pa->count[r] / R;
+        s -= p * log (p);
+      }
+
+  return s;
+}
+
+/* Anneals R replicas of sys through the temperatures in out->x, with
+ * n_sweeps sweeps of step_kind at each, filling the rows of out with
+ * population averages (n_equil holds the sweeps per replica). If not
+ * NULL, ln_z receives ln (Z(T_k) / Z(T_0)) and s_family the family
+ * entropy, whose exponential is the effective number of independent
+ * families left. */
+void
+spnr_pa_run (spnr_scan_t * const out, double * const ln_z,
+             double * const s_family, spnr_sys_t const * const sys,
+             spnr_step_kind_t const * const step_kind, size_t const R,
+             size_t const n_sweeps, unsigned long const seed)
+{
+  pa_t pa;
+  size_t k, r;
+  size_t const N = sys->graph->N;
+  double lz = 0, s;
+
+  if (R == 0 || out->size == 0)
+    return;
+
+  pa.R = R;
+  pa.pop = malloc_err (R * sizeof (spnr_sys_t *));
+  pa.next = malloc_err (R * sizeof (spnr_sys_t *));
+  pa.family = malloc_err (R * sizeof (size_t));
+  pa.next_family = malloc_err (R * sizeof (size_t));
+  pa.e = malloc_err (R * sizeof (double));
+  pa.m = malloc_err (R * sizeof (double));
+  pa.w = malloc_err (R * sizeof (double));
+  pa.count = malloc_err (R * sizeof (size_t));
+  for (r = 0; r < R; ++r)
+    {
+      pa.pop[r] = spnr_sys_clone (sys);
+      pa.next[r] = spnr_sys_clone (sys);
+      pa.family[r] = r;
+    }
+
+  pa.n_steps = 1;
+#ifdef _OPENMP
+  pa.n_steps = omp_get_max_threads ();
+#endif
+  pa.steps = malloc_err (pa.n_steps * sizeof (spnr_step_t *));
+  for (k = 0; k < pa.n_steps; ++k)
+    pa.steps[k] = spnr_step_alloc (step_kind, spnr_sys_spin_size (pa.pop[0]));
+
+  for (k = 0; k < out->size; ++k)
+    {
+      if (k)
+        lz += pa_resample (&pa, 1 / out->x[k] - 1 / out->x[k - 1], N,
+                           seed, k);
+      pa_sweep (&pa, out->x[k], n_sweeps, seed, k);
+
+      s = pa_summary (&pa, out, k, N);
+      out->n_equil[k] = n_sweeps;
+      if (ln_z)
+        ln_z[k] = lz;
+      if (s_family)
+        s_family[k] = s;
+    }
+
+  for (k = 0; k < pa.n_steps; ++k)
+    spnr_step_free (pa.steps[k]);
+  for (r = 0; r < R; ++r)
+    {
+      spnr_sys_free (pa.pop[r]);
+      spnr_sys_free (pa.next[r]);
+    }
+  free_err (pa.steps);
+  free_err (pa.pop);
+  free_err (pa.next);
+  free_err (pa.family);
+  free_err (pa.next_family);
+  free_err (pa.e);
+  free_err (pa.m);
+  free_err (pa.w);
+  free_err (pa.count);
+}
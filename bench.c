@@ -0,0 +1,229 @@
+/* bench.c
+ * 
+ * Copyright (C) 2024 L. Bertini
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/* Benchmark harness, built and run by `make bench`
+ *
+ * Times spnr_step_apply for every combination of system kind, graph and
+ * stepper below, together with the cost of the measurements
+ * (spnr_sys_calc_h and spnr_sys_calc_phi), and writes the results as a
+ * JSON array to stdout. Every case runs for at least min_time seconds
+ * (first argument, 0.2 by default). */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "spinner.h"
+
+#define BENCH_BETA 0.44
+#define BENCH_SEED 12345
+
+typedef struct
+{
+  char const *name;
+  spnr_sys_kind_t const * const *kind;
+  size_t param;
+} bench_sys_t;
+
+typedef struct
+{
+  spnr_graph_kind_t const * const *kind;
+  size_t L;
+  size_t D;
+} bench_graph_t;
+
+typedef struct
+{
+  spnr_step_kind_t const * const *kind;
+  spnr_graph_kind_t const * const *graph;
+  spnr_sys_kind_t const * const *sys;
+  void (*set_up) (spnr_step_t *step, size_t D);
+} bench_step_t;
+
+static bench_sys_t const systems[] =
+{
+  { "ising", &spnr_ising, 0 },
+  { "nvector2", &spnr_nvector, 2 },
+  { "nvector3", &spnr_nvector, 3 }
+};
+
+static bench_graph_t const graphs[] =
+{
+  { &spnr_cubic, 32, 2 },
+  { &spnr_cubic, 256, 2 },
+  { &spnr_cubic, 16, 3 },
+  { &spnr_cubic, 64, 3 },
+  { &spnr_powerlaw, 16, 2 },
+  { &spnr_powerlaw, 64, 2 }
+};
+
+/* energies per site of the cubic lattice lie in [-D, D] */
+static void
+wl_set_up (spnr_step_t * const step, size_t const D)
+{
+  spnr_wl_set_range (step, -1.01 * D, 1.01 * D, 64);
+}
+
+/* steppers, restricted to the graph and system kinds they need (NULL
+ * for any), with the set up they need before the first apply */
+static bench_step_t const steppers[] =
+{
+  { &spnr_metropolis, NULL, NULL, NULL },
+  { &spnr_lr_metropolis, &spnr_powerlaw, NULL, NULL },
+  { &spnr_checkerboard, &spnr_cubic, NULL, NULL },
+  { &spnr_wanglandau, &spnr_cubic, NULL, &wl_set_up },
+  { &spnr_nfold, &spnr_cubic, &spnr_ising, NULL },
+  { &spnr_worm, &spnr_cubic, &spnr_ising, NULL },
+  { &spnr_demon, NULL, NULL, NULL }
+};
+
+#define BENCH_LEN(a) (sizeof (a) / sizeof (a[0]))
+
+static double
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/* average time in seconds of one apply, repeated for at least min_time */
+static double
+time_sweeps (spnr_step_t const * const step, spnr_sys_t * const sys,
+             double const min_time, size_t * const n_sweeps,
+             double * const acc_rate)
+{
+  double t0, t;
+  size_t n = 0;
+
+  *acc_rate = 0;
+  t0 = now ();
+  do
+    {
+      spnr_step_apply (step, sys, BENCH_BETA);
+      *acc_rate += spnr_step_acc_rate (step);
+      ++n;
+    }
+  while ((t = now () - t0) < min_time);
+
+  *n_sweeps = n;
+  *acc_rate /= n;
+  return t / n;
+}
+
+static double
+time_calc_h (spnr_sys_t * const sys, double const min_time)
+{
+  double t0, t;
+  volatile float sink;
+  size_t n = 0;
+
+  t0 = now ();
+  do
+    {
+      sink = spnr_sys_calc_h (sys);
+      ++n;
+    }
+  while ((t = now () - t0) < min_time);
+  (void) sink;
+
+  return t / n;
+}
+
+static double
+time_calc_phi (spnr_sys_t * const sys, double const min_time)
+{
+  double t0, t;
+  volatile float sink;
+  size_t n = 0;
+
+  t0 = now ();
+  do
+    {
+      sink = spnr_sys_calc_phi (sys);
+      ++n;
+    }
+  while ((t = now () - t0) < min_time);
+  (void) sink;
+
+  return t / n;
+}
+
+int
+main (int argc, char **argv)
+{
+  double const min_time = argc > 1 ? atof (argv[1]) : 0.2;
+  size_t s, g, t, d, N, n_sweeps;
+  double t_sweep, t_h, t_phi, acc_rate;
+  int first = 1;
+  spnr_graph_t *graph;
+  spnr_sys_t *sys;
+  spnr_step_t *step;
+
+  printf ("[\n");
+  for (g = 0; g < BENCH_LEN (graphs); ++g)
+    {
+      for (d = 0, N = 1; d < graphs[g].D; ++d)
+        N *= graphs[g].L;
+      graph = spnr_graph_alloc (*graphs[g].kind, spnr_ferr, N, graphs[g].D);
+
+      for (s = 0; s < BENCH_LEN (systems); ++s)
+        for (t = 0; t < BENCH_LEN (steppers); ++t)
+          {
+            if ((steppers[t].graph && *steppers[t].graph != *graphs[g].kind)
+                || (steppers[t].sys && *steppers[t].sys != *systems[s].kind))
+              continue;
+
+            sys = spnr_sys_alloc (graph, *systems[s].kind, systems[s].param);
+            step = spnr_step_alloc (*steppers[t].kind,
+                                    spnr_sys_spin_size (sys));
+            if (steppers[t].set_up)
+              steppers[t].set_up (step, graphs[g].D);
+            spnr_rng_seed (BENCH_SEED);
+
+            /* one untimed sweep to warm up caches and lazy buffers */
+            spnr_step_apply (step, sys, BENCH_BETA);
+            t_sweep = time_sweeps (step, sys, min_time, &n_sweeps, &acc_rate);
+            t_h = time_calc_h (sys, min_time / 4);
+            t_phi = time_calc_phi (sys, min_time / 4);
+
+            printf ("%s  {\"sys\": \"%s\", \"graph\": \"%s\", \"L\": %lu, "
+                    "\"D\": %lu, \"N\": %lu, \"step\": \"%s\", "
+                    "\"beta\": %g, \"sweeps\": %lu, "
+                    "\"ns_per_update\": %.4f, \"updates_per_ns\": %.6f, "
+                    "\"acc_rate\": %.4f, \"calc_h_ns\": %.1f, "
+                    "\"calc_phi_ns\": %.1f}",
+                    first ? "" : ",\n", systems[s].name,
+                    (*graphs[g].kind)->name, graphs[g].L, graphs[g].D, N,
+                    (*steppers[t].kind)->name, BENCH_BETA, n_sweeps,
+                    1e9 * t_sweep / N, N / (1e9 * t_sweep), acc_rate,
+                    1e9 * t_h, 1e9 * t_phi);
+            fflush (stdout);
+            first = 0;
+
+            spnr_step_free (step);
+            spnr_sys_free (sys);
+          }
+
+      spnr_graph_free (graph);
+    }
+  printf ("\n]\n");
+
+  return 0;
+}
@@ -0,0 +1,269 @@
+/* checkerboard.c
+ * 
+ * Copyright (C) 2024 L. Bertini
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "spinner.h"
+#include "error.h"
+#include "internal.h"
+#include "rng.h"
+#include "stats.h"
+
+#define SPNR_LN2 0.69314718f
+
+/* Multi-color Metropolis
+ *
+ * Sweeps the color classes of the graph in turn, updating the sites of
+ * a class concurrently: they share no bond, so each sees its neighbors
+ * fixed. The classes are split in chunks of SPNR_SWEEP_CHUNK sites, and each
+ * chunk reseeds the stream of its thread from the sweep seed and its
+ * index, so results do not depend on the number of threads.
+ *
+ * A deterministic sweep order makes moves that are always accepted
+ * dangerous: on small or frustrated lattices a cycle of such flips can
+ * trap the chain. Moves that leave the energy unchanged are therefore
+ * accepted with probability 1/2, which still satisfies detailed
+ * balance. Like in metropolis.c, the acceptance ratios are memoized on
+ * the exact value of delta_h, in a table private to each chunk.
+ *
+ * Continuous spectra miss the table, and kinds that can draw their
+ * proposals in batches (fill_props) take a batched path instead: the
+ * proposals and energy changes of SPNR_BATCH sites of a chunk are
+ * computed first, which is valid because the sites do not interact,
+ * and a move passes when beta delta_h is below an exponential variate,
+ * which happens with probability exp (- beta delta_h). The variates and
+ * the proposals come from vectorized generators, so there is no scalar
+ * transcendental call left in the sweep. */
+
+typedef struct
+{
+  size_t spin_size;
+  spnr_graph_t const *graph;
+  spnr_graph_kind_t const *graph_kind;
+  size_t N;
+  size_t n_colors;
+  size_t *sites;
+  size_t *start;
+  float acc_rate;
+} cb_priv_t;
+
+static void *
+priv_alloc (size_t const spin_size)
+{
+  cb_priv_t * const priv = malloc_err (sizeof (cb_priv_t));
+
+  if (spin_size > SPNR_PROP_MAX)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "spin size out of bounds");
+
+  priv->spin_size = spin_size;
+  priv->graph = NULL;
+  priv->graph_kind = NULL;
+  priv->N = 0;
+  priv->n_colors = 0;
+  priv->sites = NULL;
+  priv->start = NULL;
+  priv->acc_rate = NAN;
+  return priv;
+}
+
+static void
+priv_free (void * const priv)
+{
+  cb_priv_t * const priv_ = (cb_priv_t *) priv;
+  free_err (priv_->sites);
+  free_err (priv_->start);
+  free_err (priv_);
+}
+
+/* sorts the sites by color, once per graph; the kind and size are kept
+ * too, since a freed graph may leave its address to the next one */
+static void
+set_graph (cb_priv_t * const priv, spnr_graph_t const * const graph)
+{
+  size_t k, c;
+  size_t const N = graph->N;
+  size_t * const fill = malloc_err ((graph->kind->n_colors (graph->priv) + 1)
+                                    * sizeof (size_t));
+
+  free_err (priv->sites);
+  free_err (priv->start);
+  priv->graph = graph;
+  priv->graph_kind = graph->kind;
+  priv->N = N;
+  priv->n_colors = graph->kind->n_colors (graph->priv);
+  priv->sites = malloc_err (N * sizeof (size_t));
+  priv->start = malloc_err ((priv->n_colors + 1) * sizeof (size_t));
+
+  memset (priv->start, 0, (priv->n_colors + 1) * sizeof (size_t));
+  for (k = 0; k < N; ++k)
+    ++priv->start[graph->kind->color (graph->priv, k) + 1];
+  for (c = 0; c < priv->n_colors; ++c)
+    priv->start[c + 1] += priv->start[c];
+
+  memcpy (fill, priv->start, (priv->n_colors + 1) * sizeof (size_t));
+  for (k = 0; k < N; ++k)
+    priv->sites[fill[graph->kind->color (graph->priv, k)]++] = k;
+
+  free_err (fill);
+}
+
+static float
+acc_ratio (float * const lut_delta_h, float * const lut_acc,
+           float const beta, float const delta_h)
+{
+  if (delta_h == 0)
+    return 0.5;
+
+  return spnr_lut_acc_ratio (lut_delta_h, lut_acc, beta, delta_h);
+}
+
+/* sweeps the sites first..last - 1 in batches, accepting the moves of
+ * a batch in one pass and storing the accepted proposals */
+static size_t
+sweep_batched (cb_priv_t const * const priv, spnr_sys_t const * const sys,
+               float const beta, size_t const first, size_t const last)
+{
+  spnr_graph_t const * const graph = sys->graph;
+  size_t const spin_size = priv->spin_size;
+  unsigned char props[SPNR_BATCH * SPNR_PROP_MAX];
+  float delta_h[SPNR_BATCH];
+  float e[SPNR_BATCH];
+  unsigned char acc[SPNR_BATCH];
+  size_t idx[SPNR_BATCH];
+  size_t b, i, m, n, n_acc = 0;
+
+  for (b = first; b < last; b += m)
+    {
+      m = last - b < SPNR_BATCH ? last - b : SPNR_BATCH;
+      sys->kind->fill_props (sys->priv, props, m);
+      spnr_rng_fill_exp (e, m);
+      for (i = 0; i < m; ++i)
+        delta_h[i] = graph->kind->calc_delta_h (graph->priv, sys,
+                                                props + i * spin_size,
+                                                priv->sites[b + i]);
+
+      /* exp (- beta delta_h) is 1/2 for moves that leave the energy
+       * unchanged */
+#pragma omp simd
+      for (i = 0; i < m; ++i)
+        acc[i] = (delta_h[i] < 0)
+          | ((delta_h[i] == 0) & (e[i] > SPNR_LN2))
+          | ((delta_h[i] > 0) & (beta * delta_h[i] <= e[i]));
+
+      n = 0;
+      for (i = 0; i < m; ++i)
+        {
+          idx[n] = i;
+          n += acc[i];
+        }
+      for (i = 0; i < n; ++i)
+        sys->kind->accept_prop (sys->priv, props + idx[i] * spin_size,
+                                priv->sites[b + idx[i]]);
+      n_acc += n;
+    }
+
+  return n_acc;
+}
+
+static void
+apply (void * const priv, spnr_sys_t const * const sys, float const beta)
+{
+  cb_priv_t * const priv_ = (cb_priv_t *) priv;
+  spnr_graph_t const * const graph = sys->graph;
+  size_t c, ch, i, k, first, last, n_chunks, n_acc = 0;
+  uint64_t const seed = spnr_rng_next ();
+  float delta_h;
+  SPNR_STATS_VAR (t);
+
+  if (!graph->kind->n_colors || !graph->kind->n_colors (graph->priv))
+    spnr_err (SPNR_ERROR_FUNC_NULL, "graph has no coloring");
+  if (priv_->graph != graph || priv_->graph_kind != graph->kind
+      || priv_->N != graph->N)
+    set_graph (priv_, graph);
+
+  SPNR_STATS_TIC (t);
+  for (c = 0; c < priv_->n_colors; ++c)
+    {
+      first = priv_->start[c];
+      last = priv_->start[c + 1];
+      n_chunks = (last - first + SPNR_SWEEP_CHUNK - 1) / SPNR_SWEEP_CHUNK;
+
+#pragma omp parallel for private (i, k, delta_h) reduction (+:n_acc) \
+  schedule (dynamic) if (last - first >= SPNR_PAR_MIN)
+      for (ch = 0; ch < n_chunks; ++ch)
+        {
+          unsigned char prop[SPNR_PROP_MAX];
+          float lut_delta_h[SPNR_METR_LUT_SIZE];
+          float lut_acc[SPNR_METR_LUT_SIZE];
+          size_t const end = (first + (ch + 1) * SPNR_SWEEP_CHUNK < last)
+            ? first + (ch + 1) * SPNR_SWEEP_CHUNK : last;
+
+          spnr_rng_seed (spnr_rng_hash (seed, graph->N * c + ch));
+          if (sys->kind->fill_props)
+            {
+              n_acc += sweep_batched (priv_, sys, beta,
+                                      first + ch * SPNR_SWEEP_CHUNK, end);
+              continue;
+            }
+
+          for (i = 0; i < SPNR_METR_LUT_SIZE; ++i)
+            lut_delta_h[i] = NAN;
+          for (i = first + ch * SPNR_SWEEP_CHUNK; i < end; ++i)
+            {
+              k = priv_->sites[i];
+              sys->kind->fill_prop (sys->priv, prop, k);
+              delta_h = graph->kind->calc_delta_h (graph->priv, sys, prop, k);
+              if (delta_h < 0
+                  || spnr_rng_unif () < acc_ratio (lut_delta_h, lut_acc,
+                                                   beta, delta_h))
+                {
+                  sys->kind->accept_prop (sys->priv, prop, k);
+                  ++n_acc;
+                }
+            }
+        }
+    }
+  SPNR_STATS_LAP (t, SPNR_PHASE_STEP);
+
+  /* the calling thread continues from a stream of its own */
+  spnr_rng_seed (spnr_rng_hash (~seed, 0));
+
+  priv_->acc_rate = (float) n_acc / graph->N;
+  SPNR_STATS_ADD (n_prop, graph->N);
+  SPNR_STATS_ADD (n_acc, n_acc);
+}
+
+static float
+acc_rate (void const * const priv)
+{
+  return ((cb_priv_t const *) priv)->acc_rate;
+}
+
+static const spnr_step_kind_t checkerboard_kind =
+{
+  "checkerboard",
+  &priv_alloc,
+  &priv_free,
+  &apply,
+  &acc_rate
+};
+
+const spnr_step_kind_t *spnr_checkerboard = &checkerboard_kind;
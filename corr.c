@@ -0,0 +1,177 @@
+/* corr.c
+ * 
+ * Copyright (C) 2024 L. Bertini
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+
+#include "spinner.h"
+#include "error.h"
+#include "fft.h"
+
+/* Spin-spin correlations via FFT
+ *
+ * Each call to spnr_corr_add transforms the configuration, two spin
+ * components at a time packed as the real and imaginary parts of one
+ * complex field Z = a + i b. Since a and b are real,
+ * |A(k)|^2 + |B(k)|^2 = (|Z(k)|^2 + |Z(-k)|^2) / 2, so one transform
+ * gives the structure factor of both. Only the running average of S(k)
+ * is kept; G(r) is its inverse transform (Wiener-Khinchin).
+ *
+ * Sides L which are not powers of two fall back to the plain DFT of
+ * fft.c along each axis, so a transform costs O(N L) instead of
+ * O(N log L). */
+
+/* index of -k, componentwise modulo L */
+static size_t
+neg_index (size_t const i, size_t const L, size_t const D)
+{
+  size_t d, x, unit, r = 0;
+
+  for (d = 0, unit = 1; d < D; ++d, unit *= L)
+    {
+      x = (i / unit) % L;
+      r += ((L - x) % L) * unit;
+    }
+
+  return r;
+}
+
+spnr_corr_t *
+spnr_corr_alloc (spnr_graph_t const * const graph)
+{
+  spnr_corr_t * const corr = malloc_err (sizeof (spnr_corr_t));
+
+  if (!graph->kind->dims)
+    spnr_err (SPNR_ERROR_FUNC_NULL, "graph kind has no lattice geometry");
+
+  corr->N = graph->N;
+  corr->D = graph->kind->dims (graph->priv, &corr->L);
+  corr->s_k = malloc_err (corr->N * sizeof (double));
+  corr->re = malloc_err (corr->N * sizeof (double));
+  corr->im = malloc_err (corr->N * sizeof (double));
+  corr->comps = NULL;
+  corr->n_comps = 0;
+  spnr_corr_reset (corr);
+
+  return corr;
+}
+
+void
+spnr_corr_free (spnr_corr_t * const corr)
+{
+  free_err (corr->s_k);
+  free_err (corr->re);
+  free_err (corr->im);
+  free_err (corr->comps);
+  free_err (corr);
+}
+
+void
+spnr_corr_reset (spnr_corr_t * const corr)
+{
+  corr->n_samples = 0;
+  memset (corr->s_k, 0, corr->N * sizeof (double));
+}
+
+/* adds the current configuration of sys to the running average */
+void
+spnr_corr_add (spnr_corr_t * const corr, spnr_sys_t const * const sys)
+{
+  size_t i, c;
+  size_t const N = corr->N, n = spnr_sys_n_comps (sys);
+  double * const re = corr->re;
+  double * const im = corr->im;
+  double const w = 1.0 / (corr->n_samples + 1);
+  double s;
+
+  if (sys->graph->N != N)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "system and correlator sizes differ");
+
+  if (corr->n_comps != n)
+    {
+      free_err (corr->comps);
+      corr->comps = malloc_err (N * n * sizeof (float));
+      corr->n_comps = n;
+    }
+  sys->kind->get_comps (sys->priv, corr->comps, 0, N);
+
+  /* S(k) of this configuration, scaled by the weight of the new sample
+   * in the running average */
+  for (i = 0; i < N; ++i)
+    corr->s_k[i] *= 1 - w;
+
+  for (c = 0; c < n; c += 2)
+    {
+      for (i = 0; i < N; ++i)
+        {
+          re[i] = corr->comps[i * n + c];
+          im[i] = (c + 1 < n) ? corr->comps[i * n + c + 1] : 0;
+        }
+      spnr_fft_nd (re, im, corr->L, corr->D, SPNR_FALSE);
+
+      for (i = 0; i < N; ++i)
+        {
+          size_t const j = neg_index (i, corr->L, corr->D);
+          s = re[i] * re[i] + im[i] * im[i] + re[j] * re[j] + im[j] * im[j];
+          corr->s_k[i] += w * s / (2 * N);
+        }
+    }
+
+  ++corr->n_samples;
+}
+
+/* G(r) = < s_x . s_(x+r) > averaged over x and over the samples, for
+ * every displacement r in lattice order; g must hold N values */
+void
+spnr_corr_calc_g (spnr_corr_t const * const corr, double * const g)
+{
+  size_t i;
+  size_t const N = corr->N;
+  double * const im = malloc_err (N * sizeof (double));
+
+  for (i = 0; i < N; ++i)
+    {
+      g[i] = corr->s_k[i];
+      im[i] = 0;
+    }
+  spnr_fft_nd (g, im, corr->L, corr->D, SPNR_TRUE);
+
+  free_err (im);
+}
+
+/* G(r) and S(k) along the first lattice axis, r = k_index = 0 .. L-1 */
+void
+spnr_corr_write (spnr_corr_t const * const corr, char const * const fname)
+{
+  FILE *f;
+  size_t x;
+  double * const g = malloc_err (corr->N * sizeof (double));
+
+  spnr_corr_calc_g (corr, g);
+
+  f = fopen (fname, "w");
+  if (!f)
+    spnr_err (SPNR_FAILURE, "cannot open correlation output file");
+
+  fprintf (f, "# x G(x) S(2 pi x / L)\n");
+  for (x = 0; x < corr->L; ++x)
+    fprintf (f, "%lu %+f %f\n", x, g[x], corr->s_k[x]);
+
+  fclose (f);
+  free_err (g);
+}
@@ -18,11 +18,13 @@
  */
 
 #include <math.h>
+#include <stdint.h>
+#include <string.h>
 
 #include "spinner.h"
 #include "error.h"
-
-#define SPNR_DIMS_MAX 8
+#include "internal.h"
+#include "graphio.h"
 
 typedef struct
 {
@@ -31,10 +33,23 @@ typedef struct
   
   float *J;
   size_t *neighbors;
+  int mapped;
 } cubic_priv_t;
 
+/* saved graph: this header, then J and the neighbors */
+typedef union
+{
+  struct
+  {
+    uint64_t L;
+    uint64_t D;
+  } h;
+  char pad[SPNR_FILE_ALIGN];
+} cubic_file_t;
+
 static void *
-priv_alloc (float (*getter)(), size_t const N, size_t const D)
+priv_alloc (spnr_getter_t const getter, spnr_getter_args_t const * const args,
+            size_t const N, size_t const D)
 {
   size_t i, j;
   size_t unit, row, last_row, left;
@@ -48,11 +63,15 @@ priv_alloc (float (*getter)(), size_t const N, size_t const D)
   priv->L = nearbyintf (pow (N, 1.0/D));
   priv->D = D;
   priv->J = malloc_err (N*2*D * sizeof (float));
-  priv->neighbors = malloc (N*2*D * sizeof (size_t));
+  priv->neighbors = malloc_err (N*2*D * sizeof (size_t));
+  priv->mapped = SPNR_FALSE;
 
   for (i = 0; i <= D; ++i)
     slices[i] = pow (priv->L, i);
   
+  /* bond (i, j) only writes the entries of i and of its left neighbor
+   * along j, so sites can be filled concurrently */
+#pragma omp parallel for private (j, unit, row, last_row, left)
   for (i = 0; i < N; ++i)
     {
       for (j = 0; j < D; ++j)
@@ -62,7 +81,7 @@ priv_alloc (float (*getter)(), size_t const N, size_t const D)
           last_row = row - unit;
           left = ((i % row) < unit) ? (i + last_row) : (i - unit);
       
-          priv->J[i*2*D + j] = getter ();
+          priv->J[i*2*D + j] = getter (args, i*D + j);
           priv->J[left*2*D + j + D] = priv->J[i*2*D + j];
           
           priv->neighbors[i*2*D + j] = left;
@@ -77,9 +96,48 @@ static void
 priv_free (void * const priv)
 {
   cubic_priv_t *priv_cast = (cubic_priv_t*)priv;
-  free (priv_cast->J);
-  free (priv_cast->neighbors);
-  free (priv_cast);
+  if (!priv_cast->mapped)
+    {
+      free_err (priv_cast->J);
+      free_err (priv_cast->neighbors);
+    }
+  free_err (priv_cast);
+}
+
+static void
+save (void const * const priv, size_t const N, FILE * const f)
+{
+  cubic_priv_t const * const priv_ = (cubic_priv_t *) priv;
+  size_t const n_bonds = N * 2 * priv_->D;
+  cubic_file_t hdr;
+
+  memset (&hdr, 0, sizeof (hdr));
+  hdr.h.L = priv_->L;
+  hdr.h.D = priv_->D;
+  spnr_file_write (f, &hdr, sizeof (hdr));
+  spnr_file_write (f, priv_->J, n_bonds * sizeof (float));
+  spnr_file_write (f, priv_->neighbors, n_bonds * sizeof (size_t));
+}
+
+/* the arrays are used in place, read-only */
+static void *
+map (void const * const data, size_t const len, size_t const N)
+{
+  cubic_file_t const * const hdr = (cubic_file_t const *) data;
+  cubic_priv_t * const priv = malloc_err (sizeof (cubic_priv_t));
+  size_t const n_bonds = N * 2 * hdr->h.D;
+  size_t const J_len = spnr_file_round (n_bonds * sizeof (float));
+
+  if (len < sizeof (cubic_file_t) + J_len + n_bonds * sizeof (size_t))
+    spnr_err (SPNR_FAILURE, "truncated graph file");
+
+  priv->L = hdr->h.L;
+  priv->D = hdr->h.D;
+  priv->J = (float *) (hdr + 1);
+  priv->neighbors = (size_t *) ((char *) priv->J + J_len);
+  priv->mapped = SPNR_TRUE;
+
+  return priv;
 }
 
 static float
@@ -91,7 +149,7 @@ calc_delta_h (void const * const priv,
   cubic_priv_t const * const priv_ = (cubic_priv_t *) priv;
   size_t const stride = 2 * priv_->D;
   
-  return sys->kind->calc_delta_h_binary (sys->priv, stride,
+  return sys->kind->calc_delta_h_binary (sys->priv, &sys->field, stride,
                                          priv_->J + k * stride,
                                          priv_->neighbors + k * stride,
                                          prop, k);
@@ -102,10 +160,11 @@ calc_h (void const * const priv, size_t const N, spnr_sys_t const * const sys)
 {
   cubic_priv_t const * const priv_ = (cubic_priv_t *) priv;
   size_t i, stride = 2 * priv_->D;
-  float h = 0;
+  double h = 0;
   
+#pragma omp parallel for reduction (+:h) if (N >= SPNR_PAR_MIN)
   for (i = 0; i < N; ++i)
-    h += sys->kind->calc_part_h_binary (sys->priv, stride,
+    h += sys->kind->calc_part_h_binary (sys->priv, &sys->field, stride,
                                         priv_->J + i * stride,
                                         priv_->neighbors + i * stride,
                                         i);
@@ -113,13 +172,66 @@ calc_h (void const * const priv, size_t const N, spnr_sys_t const * const sys)
   return h / (2.0*N);
 }
 
+static size_t
+dims (void const * const priv, size_t * const L)
+{
+  cubic_priv_t const * const priv_ = (cubic_priv_t *) priv;
+  *L = priv_->L;
+  return priv_->D;
+}
+
+static size_t
+get_neighbors (void const * const priv, size_t const k, size_t * const nbrs)
+{
+  cubic_priv_t const * const priv_ = (cubic_priv_t *) priv;
+  size_t const stride = 2 * priv_->D;
+
+  memcpy (nbrs, priv_->neighbors + k * stride, stride * sizeof (size_t));
+  return stride;
+}
+
+static void
+get_couplings (void const * const priv, size_t const k, float * const J)
+{
+  cubic_priv_t const * const priv_ = (cubic_priv_t *) priv;
+  size_t const stride = 2 * priv_->D;
+
+  memcpy (J, priv_->J + k * stride, stride * sizeof (float));
+}
+
+/* checkerboard, for even L */
+static size_t
+n_colors (void const * const priv)
+{
+  return ((cubic_priv_t *) priv)->L % 2 ? 0 : 2;
+}
+
+static size_t
+color (void const * const priv, size_t const k)
+{
+  cubic_priv_t const * const priv_ = (cubic_priv_t *) priv;
+  size_t d, x = k, c = 0;
+
+  for (d = 0; d < priv_->D; ++d, x /= priv_->L)
+    c += x % priv_->L;
+
+  return c % 2;
+}
+
 static const spnr_graph_kind_t cubic_kind =
 {
   "cubic",
   &priv_alloc,
   &priv_free,
   &calc_delta_h,
-  &calc_h
+  &calc_h,
+  &save,
+  &map,
+  &dims,
+  &get_neighbors,
+  &get_couplings,
+  &n_colors,
+  &color
 };
 
-const spnr_graph_kind_t *spnr_cubic = &cubic_kind;
\ No newline at end of file
+const spnr_graph_kind_t *spnr_cubic = &cubic_kind;
@@ -17,16 +17,25 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
  */
 
+#include <string.h>
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
 #include "spinner.h"
+#include "error.h"
+#include "stats.h"
 
 spnr_data_t *
 spnr_data_alloc (size_t const size)
 {
-  spnr_data_t * const data = malloc (sizeof (spnr_data_t));
+  spnr_data_t * const data = malloc_err (sizeof (spnr_data_t));
   
   data->size = size;
-  data->h = malloc (data->size * sizeof (float));
-  data->phi = malloc (data->size * sizeof (float));
+  data->h = malloc_err (data->size * sizeof (float));
+  data->phi = malloc_err (data->size * sizeof (float));
+  data->stats = malloc_err (sizeof (spnr_stats_t));
+  memset (data->stats, 0, sizeof (spnr_stats_t));
   
   return data;
 }
@@ -34,9 +43,10 @@ spnr_data_alloc (size_t const size)
 void
 spnr_data_free (spnr_data_t * const data)
 {
-  free (data->h);
-  free (data->phi);
-  free (data);
+  free_err (data->h);
+  free_err (data->phi);
+  free_err (data->stats);
+  free_err (data);
 }
 
 void
@@ -152,14 +162,214 @@ spnr_data_run_and_probe (spnr_data_t * const data,
   float const beta = 1.0 / temp;
   float * const h = data->h;
   float * const phi = data->phi;
+  SPNR_STATS_VAR (t);
   
+  SPNR_STATS_BIND (data->stats);
+  SPNR_STATS_TIC (t);
   h[0] = spnr_sys_calc_h (sys);
   phi[0] = spnr_sys_calc_phi (sys);
+  SPNR_STATS_LAP (t, SPNR_PHASE_MEASURE);
+  SPNR_STATS_ADD (n_probes, 1);
   for (i = 1; i < n_probes; ++i)
   {
     for (j = 0; j < n_steps_before_probe; ++j)
       spnr_step_apply (step, sys, beta);
+    
+    /* the stepper rebinds the counters to its own */
+    SPNR_STATS_BIND (data->stats);
+    SPNR_STATS_LAP (t, SPNR_PHASE_STEP);
+    SPNR_STATS_ADD (n_sweeps, n_steps_before_probe);
     h[i] = spnr_sys_calc_h (sys);
     phi[i] = spnr_sys_calc_phi (sys);
+    SPNR_STATS_LAP (t, SPNR_PHASE_MEASURE);
+    SPNR_STATS_ADD (n_probes, 1);
   }
-}
\ No newline at end of file
+}
+
+/* Pipelined probing
+ *
+ * The snapshots form a ring of n_bufs clones: the sweep thread fills
+ * the slot at head and the measurement thread empties the one at tail,
+ * count being the number of filled slots. Only the copy into a free
+ * slot, and the wait for one when the ring is full, stall the sweeps;
+ * with instrumentation on they are what SPNR_PHASE_MEASURE counts. */
+
+#define SPNR_ASYNC_BUFS 2
+
+typedef struct
+{
+  spnr_data_t *data;
+  spnr_sys_t **snap;
+  size_t *index;
+  size_t n_bufs;
+  spnr_probe_hook_t hook;
+  void *ctx;
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+#endif
+  size_t head;
+  size_t tail;
+  size_t count;
+  int done;
+} async_t;
+
+static void
+async_measure (async_t * const a, size_t const slot)
+{
+  spnr_sys_t * const snap = a->snap[slot];
+  size_t const i = a->index[slot];
+
+  a->data->h[i] = spnr_sys_calc_h (snap);
+  a->data->phi[i] = spnr_sys_calc_phi (snap);
+  if (a->hook)
+    a->hook (snap, i, a->ctx);
+}
+
+#ifdef HAVE_PTHREAD_H
+
+static void *
+async_consumer (void * const arg)
+{
+  async_t * const a = arg;
+  size_t slot;
+
+  for (;;)
+    {
+      pthread_mutex_lock (&a->lock);
+      while (!a->count && !a->done)
+        pthread_cond_wait (&a->not_empty, &a->lock);
+      if (!a->count)
+        {
+          pthread_mutex_unlock (&a->lock);
+          return NULL;
+        }
+      slot = a->tail;
+      pthread_mutex_unlock (&a->lock);
+
+      async_measure (a, slot);
+
+      pthread_mutex_lock (&a->lock);
+      a->tail = (a->tail + 1) % a->n_bufs;
+      --a->count;
+      pthread_cond_signal (&a->not_full);
+      pthread_mutex_unlock (&a->lock);
+    }
+}
+
+/* copies sys into the next free slot, blocking while the ring is full */
+static void
+async_push (async_t * const a, spnr_sys_t const * const sys, size_t const i)
+{
+  size_t slot;
+
+  pthread_mutex_lock (&a->lock);
+  while (a->count == a->n_bufs)
+    pthread_cond_wait (&a->not_full, &a->lock);
+  slot = a->head;
+  pthread_mutex_unlock (&a->lock);
+
+  /* the consumer never touches a free slot */
+  spnr_sys_copy (a->snap[slot], sys);
+  a->index[slot] = i;
+
+  pthread_mutex_lock (&a->lock);
+  a->head = (a->head + 1) % a->n_bufs;
+  ++a->count;
+  pthread_cond_signal (&a->not_empty);
+  pthread_mutex_unlock (&a->lock);
+}
+
+#else
+
+static void
+async_push (async_t * const a, spnr_sys_t const * const sys, size_t const i)
+{
+  spnr_sys_copy (a->snap[0], sys);
+  a->index[0] = i;
+  async_measure (a, 0);
+}
+
+#endif
+
+void
+spnr_data_run_and_probe_async (spnr_data_t * const data,
+                               spnr_sys_t * const sys,
+                               spnr_step_t const * const step,
+                               float const temp,
+                               size_t const n_steps_before_probe,
+                               size_t const n_bufs,
+                               spnr_probe_hook_t const hook,
+                               void * const ctx)
+{
+  size_t i, j;
+  size_t const n_probes = data->size;
+  float const beta = 1.0 / temp;
+  async_t a;
+#ifdef HAVE_PTHREAD_H
+  pthread_t consumer;
+#endif
+  SPNR_STATS_VAR (t);
+
+  a.data = data;
+#ifdef HAVE_PTHREAD_H
+  a.n_bufs = n_bufs ? n_bufs : SPNR_ASYNC_BUFS;
+#else
+  /* probes are measured as they are pushed, one snapshot is enough */
+  (void) n_bufs;
+  a.n_bufs = 1;
+#endif
+  a.hook = hook;
+  a.ctx = ctx;
+  a.head = a.tail = a.count = 0;
+  a.done = SPNR_FALSE;
+  a.snap = malloc_err (a.n_bufs * sizeof (spnr_sys_t *));
+  a.index = malloc_err (a.n_bufs * sizeof (size_t));
+  for (i = 0; i < a.n_bufs; ++i)
+    a.snap[i] = spnr_sys_clone (sys);
+
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_init (&a.lock, NULL);
+  pthread_cond_init (&a.not_empty, NULL);
+  pthread_cond_init (&a.not_full, NULL);
+  if (pthread_create (&consumer, NULL, async_consumer, &a))
+    spnr_err (SPNR_FAILURE, "cannot start the measurement thread");
+#endif
+
+  SPNR_STATS_BIND (data->stats);
+  SPNR_STATS_TIC (t);
+  for (i = 0; i < n_probes; ++i)
+  {
+    if (i)
+      {
+        for (j = 0; j < n_steps_before_probe; ++j)
+          spnr_step_apply (step, sys, beta);
+
+        /* the stepper rebinds the counters to its own */
+        SPNR_STATS_BIND (data->stats);
+        SPNR_STATS_LAP (t, SPNR_PHASE_STEP);
+        SPNR_STATS_ADD (n_sweeps, n_steps_before_probe);
+      }
+    async_push (&a, sys, i);
+    SPNR_STATS_LAP (t, SPNR_PHASE_MEASURE);
+    SPNR_STATS_ADD (n_probes, 1);
+  }
+
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_lock (&a.lock);
+  a.done = SPNR_TRUE;
+  pthread_cond_signal (&a.not_empty);
+  pthread_mutex_unlock (&a.lock);
+  pthread_join (consumer, NULL);
+
+  pthread_mutex_destroy (&a.lock);
+  pthread_cond_destroy (&a.not_empty);
+  pthread_cond_destroy (&a.not_full);
+#endif
+
+  for (i = 0; i < a.n_bufs; ++i)
+    spnr_sys_free (a.snap[i]);
+  free_err (a.snap);
+  free_err (a.index);
+}
@@ -0,0 +1,307 @@
+/* demon.c
+ * 
+ * Copyright (C) 2024 L. Bertini
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "spinner.h"
+#include "error.h"
+#include "internal.h"
+#include "rng.h"
+#include "stats.h"
+
+/* Creutz demons
+ *
+ * Microcanonical dynamics: every block of SPNR_SWEEP_CHUNK sites has a demon
+ * holding a non-negative energy, a move is accepted when the demon of
+ * its block can pay for it, and the demon takes what the move releases,
+ * so the energy of the system plus the demons is conserved. There is
+ * no exponential and no random number per move (Ising proposals are
+ * deterministic flips). On graphs with a coloring the blocks are
+ * chunks of the color classes, swept concurrently like in
+ * checkerboard.c; otherwise the sites are swept in order.
+ *
+ * In equilibrium each demon is distributed like exp (- beta E_d), and
+ * the temperature is the maximum likelihood fit of the mean energy of
+ * the demons, sampled before every move. The dynamics is deterministic
+ * and need not be ergodic on small lattices. */
+
+typedef struct
+{
+  size_t spin_size;
+  spnr_sys_t const *sys;
+  size_t N;
+  size_t n_colors;
+  size_t *sites;
+  size_t *start;
+  size_t n_demons;
+  double *demon;
+  double e_init;
+  double e_sum;
+  size_t n_samples;
+  float acc_rate;
+} demon_priv_t;
+
+static void *
+priv_alloc (size_t const spin_size)
+{
+  demon_priv_t * const priv = malloc_err (sizeof (demon_priv_t));
+
+  if (spin_size > SPNR_PROP_MAX)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "spin size out of bounds");
+
+  priv->spin_size = spin_size;
+  priv->sys = NULL;
+  priv->N = 0;
+  priv->n_colors = 0;
+  priv->sites = NULL;
+  priv->start = NULL;
+  priv->n_demons = 0;
+  priv->demon = NULL;
+  priv->e_init = 0;
+  priv->e_sum = 0;
+  priv->n_samples = 0;
+  priv->acc_rate = NAN;
+  return priv;
+}
+
+static void
+priv_free (void * const priv)
+{
+  demon_priv_t * const priv_ = (demon_priv_t *) priv;
+  free_err (priv_->sites);
+  free_err (priv_->start);
+  free_err (priv_->demon);
+  free_err (priv_);
+}
+
+/* sorts the sites by color, a single class without coloring, and gives
+ * a demon to each chunk of the largest class; the demons start from
+ * e_init */
+static void
+set_sys (demon_priv_t * const priv, spnr_sys_t const * const sys)
+{
+  spnr_graph_t const * const graph = sys->graph;
+  size_t k, c, n;
+  size_t const N = graph->N;
+  size_t *fill;
+
+  free_err (priv->sites);
+  free_err (priv->start);
+  free_err (priv->demon);
+  priv->sys = sys;
+  priv->N = N;
+  priv->n_colors = graph->kind->n_colors ? graph->kind->n_colors (graph->priv)
+    : 0;
+  priv->sites = malloc_err (N * sizeof (size_t));
+  priv->start = malloc_err (((priv->n_colors ? priv->n_colors : 1) + 1)
+                            * sizeof (size_t));
+
+  if (!priv->n_colors)
+    {
+      for (k = 0; k < N; ++k)
+        priv->sites[k] = k;
+      priv->start[0] = 0;
+      priv->start[1] = N;
+    }
+  else
+    {
+      fill = malloc_err ((priv->n_colors + 1) * sizeof (size_t));
+      memset (priv->start, 0, (priv->n_colors + 1) * sizeof (size_t));
+      for (k = 0; k < N; ++k)
+        ++priv->start[graph->kind->color (graph->priv, k) + 1];
+      for (c = 0; c < priv->n_colors; ++c)
+        priv->start[c + 1] += priv->start[c];
+
+      memcpy (fill, priv->start, (priv->n_colors + 1) * sizeof (size_t));
+      for (k = 0; k < N; ++k)
+        priv->sites[fill[graph->kind->color (graph->priv, k)]++] = k;
+      free_err (fill);
+    }
+
+  priv->n_demons = 0;
+  for (c = 0; c < (priv->n_colors ? priv->n_colors : 1); ++c)
+    {
+      n = (priv->start[c + 1] - priv->start[c] + SPNR_SWEEP_CHUNK - 1)
+        / SPNR_SWEEP_CHUNK;
+      if (n > priv->n_demons)
+        priv->n_demons = n;
+    }
+  priv->demon = malloc_err (priv->n_demons * sizeof (double));
+  for (k = 0; k < priv->n_demons; ++k)
+    priv->demon[k] = priv->e_init;
+
+  priv->e_sum = 0;
+  priv->n_samples = 0;
+}
+
+/* sweeps the sites first..last - 1 with the demon d, adding its energy
+ * before each move to e_sum */
+static size_t
+sweep_block (demon_priv_t const * const priv, spnr_sys_t const * const sys,
+             size_t const first, size_t const last, double * const d,
+             double * const e_sum)
+{
+  spnr_graph_t const * const graph = sys->graph;
+  unsigned char prop[SPNR_PROP_MAX];
+  size_t i, k, n_acc = 0;
+  float delta_h;
+
+  for (i = first; i < last; ++i)
+    {
+      k = priv->sites[i];
+      *e_sum += *d;
+      sys->kind->fill_prop (sys->priv, prop, k);
+      delta_h = graph->kind->calc_delta_h (graph->priv, sys, prop, k);
+      if (delta_h <= *d)
+        {
+          sys->kind->accept_prop (sys->priv, prop, k);
+          *d -= delta_h;
+          ++n_acc;
+        }
+    }
+
+  return n_acc;
+}
+
+static void
+apply (void * const priv, spnr_sys_t const * const sys, float const beta)
+{
+  demon_priv_t * const priv_ = (demon_priv_t *) priv;
+  spnr_graph_t const * const graph = sys->graph;
+  size_t c, ch, first, last, n_chunks, n_acc = 0;
+  uint64_t const seed = spnr_rng_next ();
+  double e_sum = 0;
+  SPNR_STATS_VAR (t);
+
+  (void) beta;
+  if (priv_->sys != sys || priv_->N != graph->N)
+    set_sys (priv_, sys);
+
+  SPNR_STATS_TIC (t);
+  for (c = 0; c < (priv_->n_colors ? priv_->n_colors : 1); ++c)
+    {
+      first = priv_->start[c];
+      last = priv_->start[c + 1];
+      n_chunks = (last - first + SPNR_SWEEP_CHUNK - 1) / SPNR_SWEEP_CHUNK;
+
+      /* Ising flips draw nothing; other kinds draw their proposals from
+       * per-chunk streams */
+#pragma omp parallel for reduction (+:n_acc, e_sum) schedule (dynamic) \
+  if (priv_->n_colors && last - first >= SPNR_PAR_MIN)
+      for (ch = 0; ch < n_chunks; ++ch)
+        {
+          size_t const end = (first + (ch + 1) * SPNR_SWEEP_CHUNK < last)
+            ? first + (ch + 1) * SPNR_SWEEP_CHUNK : last;
+
+          spnr_rng_seed (spnr_rng_hash (seed, graph->N * c + ch));
+          n_acc += sweep_block (priv_, sys, first + ch * SPNR_SWEEP_CHUNK, end,
+                                priv_->demon + ch, &e_sum);
+        }
+    }
+  SPNR_STATS_LAP (t, SPNR_PHASE_STEP);
+
+  /* the calling thread continues from a stream of its own */
+  spnr_rng_seed (spnr_rng_hash (~seed, 0));
+
+  priv_->e_sum += e_sum;
+  priv_->n_samples += graph->N;
+
+  priv_->acc_rate = (float) n_acc / graph->N;
+  SPNR_STATS_ADD (n_prop, graph->N);
+  SPNR_STATS_ADD (n_acc, n_acc);
+}
+
+static float
+acc_rate (void const * const priv)
+{
+  return ((demon_priv_t const *) priv)->acc_rate;
+}
+
+static const spnr_step_kind_t demon_kind =
+{
+  "demon",
+  &priv_alloc,
+  &priv_free,
+  &apply,
+  &acc_rate
+};
+
+const spnr_step_kind_t *spnr_demon = &demon_kind;
+
+static demon_priv_t *
+demon_priv (spnr_step_t const * const step)
+{
+  if (step->kind != spnr_demon)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "stepper is not a demon stepper");
+  return (demon_priv_t *) step->priv;
+}
+
+void
+spnr_demon_set_energy (spnr_step_t * const step, double const e)
+{
+  demon_priv_t * const priv = demon_priv (step);
+  size_t k;
+
+  if (e < 0)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "demon energy must be non-negative");
+
+  priv->e_init = e;
+  for (k = 0; k < priv->n_demons; ++k)
+    priv->demon[k] = e;
+  spnr_demon_reset (step);
+}
+
+void
+spnr_demon_reset (spnr_step_t * const step)
+{
+  demon_priv_t * const priv = demon_priv (step);
+  priv->e_sum = 0;
+  priv->n_samples = 0;
+}
+
+/* total, not per site */
+double
+spnr_demon_energy (spnr_step_t const * const step)
+{
+  demon_priv_t const * const priv = demon_priv (step);
+  double e = 0;
+  size_t k;
+
+  for (k = 0; k < priv->n_demons; ++k)
+    e += priv->demon[k];
+  return e;
+}
+
+/* the demon energies are multiples of quantum, or continuous if it is
+ * 0: <E_d> = quantum / (exp (beta quantum) - 1) or 1 / beta */
+double
+spnr_demon_temp (spnr_step_t const * const step, double const quantum)
+{
+  demon_priv_t const * const priv = demon_priv (step);
+  double mean;
+
+  if (!priv->n_samples)
+    return NAN;
+  mean = priv->e_sum / priv->n_samples;
+  if (mean <= 0)
+    return 0;
+  return quantum > 0 ? quantum / log1p (quantum / mean) : mean;
+}
@@ -34,12 +34,3 @@ spnr_warn (int warn, char const *mess)
 {
   fprintf (stderr, "WARNING: %s\n", mess);
 }
-
-void *
-malloc_err (size_t const size)
-{
-  void * const p = malloc (size);
-  if (!p)
-    spnr_err (SPNR_ERROR_ALLOC, "malloc returned NULL");
-  return p;
-}
\ No newline at end of file
@@ -45,7 +45,12 @@ enum
 extern void spnr_warn (int warn, char const *mess);
 extern void spnr_err (int err, char const *mess);
 
+/* Library allocations: blocks are aligned to a cache line and come from
+ * the arena bound to the calling thread, if any (see spnr_arena_bind).
+ * Anything obtained from malloc_err must be released with free_err. */
+
 extern void * malloc_err (size_t size);
+extern void free_err (void *p);
 
 END_C_DECLS
 
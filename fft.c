@@ -0,0 +1,144 @@
+/* fft.c
+ * 
+ * Copyright (C) 2024 L. Bertini
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "fft.h"
+#include "error.h"
+#include "internal.h"
+
+/* radix-2 iterative transform, n must be a power of two */
+static void
+fft_radix2 (double * const re, double * const im, size_t const n,
+            int const inverse)
+{
+  size_t i, j, k, len;
+  double ang, wr, wi, cr, ci, tr, ti, ur, ui, t;
+
+  for (i = 1, j = 0; i < n; ++i)
+    {
+      size_t bit = n >> 1;
+      for (; j & bit; bit >>= 1)
+        j ^= bit;
+      j ^= bit;
+      if (i < j)
+        {
+          t = re[i]; re[i] = re[j]; re[j] = t;
+          t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+
+  for (len = 2; len <= n; len <<= 1)
+    {
+      ang = 2 * SPNR_PI / len * (inverse ? +1 : -1);
+      wr = cos (ang);
+      wi = sin (ang);
+      for (i = 0; i < n; i += len)
+        {
+          cr = 1;
+          ci = 0;
+          for (k = 0; k < len / 2; ++k)
+            {
+              ur = re[i + k];
+              ui = im[i + k];
+              tr = re[i + k + len/2] * cr - im[i + k + len/2] * ci;
+              ti = re[i + k + len/2] * ci + im[i + k + len/2] * cr;
+              re[i + k] = ur + tr;
+              im[i + k] = ui + ti;
+              re[i + k + len/2] = ur - tr;
+              im[i + k + len/2] = ui - ti;
+              t = cr * wr - ci * wi;
+              ci = cr * wi + ci * wr;
+              cr = t;
+            }
+        }
+    }
+}
+
+/* plain DFT for sides which are not powers of two; out must hold 2n */
+static void
+fft_naive (double * const re, double * const im, size_t const n,
+           int const inverse, double * const out)
+{
+  size_t j, k;
+  double ang, sr, si;
+
+  for (k = 0; k < n; ++k)
+    {
+      sr = 0;
+      si = 0;
+      for (j = 0; j < n; ++j)
+        {
+          ang = 2 * SPNR_PI * ((j * k) % n) / n * (inverse ? +1 : -1);
+          sr += re[j] * cos (ang) - im[j] * sin (ang);
+          si += re[j] * sin (ang) + im[j] * cos (ang);
+        }
+      out[k] = sr;
+      out[n + k] = si;
+    }
+  for (k = 0; k < n; ++k)
+    {
+      re[k] = out[k];
+      im[k] = out[n + k];
+    }
+}
+
+void
+spnr_fft_nd (double * const re, double * const im, size_t const L,
+             size_t const D, int const inverse)
+{
+  size_t d, i, j, base, stride, N = 1;
+  int const pow2 = (L & (L - 1)) == 0;
+  double *line = malloc_err (4 * L * sizeof (double));
+
+  for (d = 0; d < D; ++d)
+    N *= L;
+
+  for (d = 0, stride = 1; d < D; ++d, stride *= L)
+    for (base = 0; base < N; ++base)
+      {
+        if ((base / stride) % L != 0)
+          continue;
+
+        for (j = 0, i = base; j < L; ++j, i += stride)
+          {
+            line[j] = re[i];
+            line[L + j] = im[i];
+          }
+        if (pow2)
+          fft_radix2 (line, line + L, L, inverse);
+        else
+          fft_naive (line, line + L, L, inverse, line + 2 * L);
+        for (j = 0, i = base; j < L; ++j, i += stride)
+          {
+            re[i] = line[j];
+            im[i] = line[L + j];
+          }
+      }
+
+  if (inverse)
+    for (i = 0; i < N; ++i)
+      {
+        re[i] /= N;
+        im[i] /= N;
+      }
+
+  free_err (line);
+}
@@ -1,5 +1,61 @@
+/* getters.c
+ * 
+ * Copyright (C) 2024 L. Bertini
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <math.h>
+
 #include "spinner.h"
+#include "rng.h"
+#include "internal.h"
 
-float spnr_ferr () {
+float
+spnr_ferr (spnr_getter_args_t const * const args, size_t const bond)
+{
   return 1.0;
-}
\ No newline at end of file
+}
+
+float
+spnr_antiferr (spnr_getter_args_t const * const args, size_t const bond)
+{
+  return -1.0;
+}
+
+/* +1 or -1 with equal probability */
+float
+spnr_bim (spnr_getter_args_t const * const args, size_t const bond)
+{
+  return (spnr_rng_hash (args->seed, bond) >> 63) ? +1.0 : -1.0;
+}
+
+/* normal distribution with zero mean and unit variance */
+float
+spnr_gauss (spnr_getter_args_t const * const args, size_t const bond)
+{
+  uint64_t const r = spnr_rng_hash (args->seed, bond);
+  double const u = ((r >> 32) + 1.0) * 0x1.0p-32;
+  double const v = (r & 0xffffffffULL) * 0x1.0p-32;
+  
+  return sqrt (-2.0 * log (u)) * cos (2 * SPNR_PI * v);
+}
+
+/* ferromagnetic bond present with probability args->param, 0 otherwise */
+float
+spnr_dil (spnr_getter_args_t const * const args, size_t const bond)
+{
+  return (spnr_rng_hash_unif (args->seed, bond) < args->param) ? 1.0 : 0.0;
+}
@@ -17,25 +17,198 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
  */
 
+#include <stdint.h>
+#include <string.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #include "spinner.h"
 #include "error.h"
+#include "internal.h"
+#include "graphio.h"
+
+#define SPNR_GRAPH_MAGIC "SPNRGRF1"
+
+/* kinds that can be looked up by name when mapping a file */
+static spnr_graph_kind_t const * const * const kinds[] =
+{
+  &spnr_cubic,
+  &spnr_powerlaw,
+  &spnr_triangular,
+  &spnr_honeycomb,
+  &spnr_fcc,
+  &spnr_bcc
+};
+
+/* file header, followed by the payload written by the kind */
+typedef union
+{
+  struct
+  {
+    char magic[8];
+    char kind[SPNR_KIND_NAME_MAX];
+    uint64_t N;
+    uint64_t seed;
+    float param;
+    uint64_t len;
+  } h;
+  char pad[2 * SPNR_FILE_ALIGN];
+} graph_hdr_t;
 
 spnr_graph_t *
-spnr_graph_alloc (spnr_graph_kind_t const * const kind,
-                  float const (*getter)(),
-                  size_t const N,
-                  size_t const param)
+spnr_graph_alloc_args (spnr_graph_kind_t const * const kind,
+                       spnr_getter_t const getter,
+                       spnr_getter_args_t const * const args,
+                       size_t const N,
+                       size_t const param)
 {
   spnr_graph_t *graph = malloc_err (sizeof(spnr_graph_t));
   graph->N = N;
   graph->kind = kind;
-  graph->priv = kind->priv_alloc(getter, N, param);
+  graph->getter = getter;
+  graph->args = *args;
+  graph->map = NULL;
+  graph->map_len = 0;
+  graph->priv = kind->priv_alloc(getter, args, N, param);
   return graph;
 }
 
+spnr_graph_t *
+spnr_graph_alloc (spnr_graph_kind_t const * const kind,
+                  spnr_getter_t const getter,
+                  size_t const N,
+                  size_t const param)
+{
+  spnr_getter_args_t const args = { 0, 0.5 };
+  return spnr_graph_alloc_args (kind, getter, &args, N, param);
+}
+
 void
 spnr_graph_free (spnr_graph_t * const graph)
 {
   graph->kind->priv_free (graph->priv);
-  free (graph);
-}
\ No newline at end of file
+  if (graph->map)
+    {
+#ifdef HAVE_SYS_MMAN_H
+      munmap (graph->map, graph->map_len);
+#else
+      free_err (graph->map);
+#endif
+    }
+  free_err (graph);
+}
+
+void
+spnr_file_write (FILE * const f, void const * const p, size_t const size)
+{
+  static char const zeros[SPNR_FILE_ALIGN] = { 0 };
+  size_t const pad = spnr_file_round (size) - size;
+
+  if (fwrite (p, 1, size, f) != size || fwrite (zeros, 1, pad, f) != pad)
+    spnr_err (SPNR_FAILURE, "cannot write graph file");
+}
+
+void
+spnr_graph_save (spnr_graph_t const * const graph, char const * const fname)
+{
+  graph_hdr_t hdr;
+  FILE *f;
+  long end;
+
+  if (!graph->kind->save)
+    spnr_err (SPNR_ERROR_FUNC_NULL, "graph kind cannot be saved");
+
+  f = fopen (fname, "wb");
+  if (!f)
+    spnr_err (SPNR_FAILURE, "cannot open graph file");
+
+  memset (&hdr, 0, sizeof (hdr));
+  memcpy (hdr.h.magic, SPNR_GRAPH_MAGIC, sizeof (hdr.h.magic));
+  strncpy (hdr.h.kind, graph->kind->name, SPNR_KIND_NAME_MAX - 1);
+  hdr.h.N = graph->N;
+  hdr.h.seed = graph->args.seed;
+  hdr.h.param = graph->args.param;
+
+  /* the payload length is known once the kind has written it */
+  spnr_file_write (f, &hdr, sizeof (hdr));
+  graph->kind->save (graph->priv, graph->N, f);
+  end = ftell (f);
+  hdr.h.len = end - sizeof (hdr);
+  fseek (f, 0, SEEK_SET);
+  spnr_file_write (f, &hdr, sizeof (hdr));
+
+  if (fclose (f))
+    spnr_err (SPNR_FAILURE, "cannot write graph file");
+}
+
+/* maps the file read-only and shared; without mmap it is read into
+ * memory instead */
+static void *
+map_file (char const * const fname, size_t * const len)
+{
+  void *data;
+#ifdef HAVE_SYS_MMAN_H
+  struct stat st;
+  int const fd = open (fname, O_RDONLY);
+
+  if (fd < 0)
+    spnr_err (SPNR_FAILURE, "cannot open graph file");
+  if (fstat (fd, &st))
+    spnr_err (SPNR_FAILURE, "cannot stat graph file");
+
+  *len = st.st_size;
+  data = mmap (NULL, *len, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (data == MAP_FAILED)
+    spnr_err (SPNR_FAILURE, "cannot map graph file");
+#else
+  FILE * const f = fopen (fname, "rb");
+
+  if (!f)
+    spnr_err (SPNR_FAILURE, "cannot open graph file");
+  fseek (f, 0, SEEK_END);
+  *len = ftell (f);
+  fseek (f, 0, SEEK_SET);
+  data = malloc_err (*len);
+  if (fread (data, 1, *len, f) != *len)
+    spnr_err (SPNR_FAILURE, "cannot read graph file");
+  fclose (f);
+#endif
+
+  return data;
+}
+
+spnr_graph_t *
+spnr_graph_map (char const * const fname)
+{
+  spnr_graph_t * const graph = malloc_err (sizeof (spnr_graph_t));
+  graph_hdr_t const *hdr;
+  size_t i;
+
+  graph->map = map_file (fname, &graph->map_len);
+  hdr = (graph_hdr_t const *) graph->map;
+
+  if (graph->map_len < sizeof (graph_hdr_t)
+      || memcmp (hdr->h.magic, SPNR_GRAPH_MAGIC, sizeof (hdr->h.magic))
+      || graph->map_len < sizeof (graph_hdr_t) + hdr->h.len)
+    spnr_err (SPNR_FAILURE, "not a graph file");
+
+  graph->kind = NULL;
+  for (i = 0; i < sizeof (kinds) / sizeof (kinds[0]); ++i)
+    if (!strncmp (hdr->h.kind, (*kinds[i])->name, SPNR_KIND_NAME_MAX))
+      graph->kind = *kinds[i];
+  if (!graph->kind || !graph->kind->map)
+    spnr_err (SPNR_ERROR_FUNC_NULL, "graph kind cannot be mapped");
+
+  graph->N = hdr->h.N;
+  graph->getter = NULL;
+  graph->args.seed = hdr->h.seed;
+  graph->args.param = hdr->h.param;
+  graph->priv = graph->kind->map (hdr + 1, hdr->h.len, graph->N);
+
+  return graph;
+}
@@ -0,0 +1,55 @@
+/* graphio.h
+ * 
+ * Copyright (C) 2024 L. Bertini
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef GRAPHIO_H
+#define GRAPHIO_H
+
+#include <stdio.h>
+
+#undef BEGIN_C_DECLS
+#undef END_C_DECLS
+#ifdef __cplusplus
+# define BEGIN_C_DECLS extern "C" {
+# define END_C_DECLS }
+#else
+# define BEGIN_C_DECLS /* empty */
+# define END_C_DECLS /* empty */
+#endif
+
+BEGIN_C_DECLS
+
+/* Saved graphs are mapped in memory as they are, so every array in a
+ * file starts on a multiple of SPNR_FILE_ALIGN from the beginning of
+ * the payload, which is itself aligned in the file. Files use the
+ * native layout and are only portable across identical machines. */
+
+#define SPNR_FILE_ALIGN 64
+
+static inline size_t
+spnr_file_round (size_t const size)
+{
+  return (size + SPNR_FILE_ALIGN - 1) / SPNR_FILE_ALIGN * SPNR_FILE_ALIGN;
+}
+
+/* writes size bytes and pads them to SPNR_FILE_ALIGN with zeros */
+extern void spnr_file_write (FILE *f, void const *p, size_t size);
+
+END_C_DECLS
+
+#endif
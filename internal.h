@@ -0,0 +1,66 @@
+/* internal.h
+ * 
+ * Copyright (C) 2024 L. Bertini
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INTERNAL_H
+#define INTERNAL_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+/* Tuning constants shared by the library sources. */
+
+#define SPNR_PAR_MIN 4096     /* sites below which loops stay serial */
+#define SPNR_DIMS_MAX 8       /* largest supported lattice dimension */
+#define SPNR_CHUNK 64         /* sites per gather or RNG stream chunk */
+#define SPNR_SWEEP_CHUNK 1024 /* sites per parallel block of a sweep */
+#define SPNR_PROP_MAX 64      /* largest spin size of a stepper */
+#define SPNR_KIND_NAME_MAX 32 /* kind name field of the file headers */
+
+#define SPNR_PI 3.14159265358979323846
+
+/* Metropolis acceptance ratios exp (- beta delta_h), memoized in a
+ * small direct-mapped table keyed on the exact value of delta_h. The
+ * keys must start as NAN, which matches nothing, and the table is only
+ * valid for one beta. Batched sweeps draw SPNR_BATCH proposals at a
+ * time. */
+
+#define SPNR_METR_LUT_BITS 6
+#define SPNR_METR_LUT_SIZE (1 << SPNR_METR_LUT_BITS)
+#define SPNR_BATCH 64
+
+static inline float
+spnr_lut_acc_ratio (float * const lut_delta_h, float * const lut_acc,
+                    float const beta, float const delta_h)
+{
+  uint32_t bits;
+  size_t idx;
+
+  memcpy (&bits, &delta_h, sizeof (bits));
+  idx = (uint32_t) (bits * 2654435761u) >> (32 - SPNR_METR_LUT_BITS);
+  if (lut_delta_h[idx] != delta_h)
+    {
+      lut_delta_h[idx] = delta_h;
+      lut_acc[idx] = exp (- beta * delta_h);
+    }
+
+  return lut_acc[idx];
+}
+
+#endif
@@ -19,9 +19,12 @@
 
 #include <stdarg.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "spinner.h"
 #include "error.h"
+#include "internal.h"
+#include "rng.h"
 
 typedef char spin_t;
 
@@ -40,7 +43,7 @@ set_rand (void *priv, size_t N)
   spin_t *spins = (spin_t *)priv;
   size_t i;
   for (i = 0; i < N; ++i)
-      spins[i] = ((float) rand() / RAND_MAX < 0.5) ? +1 : -1;
+      spins[i] = (spnr_rng_unif () < 0.5) ? +1 : -1;
 }
 
 static void *
@@ -55,7 +58,7 @@ priv_alloc (size_t N, size_t _)
 static void
 priv_free (void *priv)
 {
-  free (priv);
+  free_err (priv);
 }
 
 static size_t
@@ -80,8 +83,23 @@ accept_prop (void * const priv, void const * const prop, size_t const k)
   spins[k] = *prop_;
 }
 
+/* single-site field acting on site k */
+static float
+site_field (spnr_field_t const * const field, size_t const k)
+{
+  float h = 0;
+  
+  if (field->uniform)
+    h += field->uniform[0];
+  if (field->site)
+    h += field->site[k];
+  
+  return h;
+}
+
 static float
 calc_delta_h_binary (void const * const priv,
+                     spnr_field_t const * const field,
                      size_t const n_sites,
                      float const * const J,
                      size_t const * const sites,
@@ -89,18 +107,19 @@ calc_delta_h_binary (void const * const priv,
                      size_t const k)
 {
   spin_t const * const spins = (spin_t*) priv;
-  float h = 0;
+  float h = site_field (field, k);
   size_t i;
   
   for (i = 0; i < n_sites; ++i)
     h += J[i] * spins[sites[i]];
   
-  //printf ("-h * -2 = %f\n", -h * -2);
   return -2 * spins[k] * -h;
 }
 
 static float
-calc_part_h_binary (void const * const priv, size_t const n_sites,
+calc_part_h_binary (void const * const priv,
+                    spnr_field_t const * const field,
+                    size_t const n_sites,
                     float const * const J, size_t const * const sites,
                     size_t const k)
 {
@@ -110,6 +129,7 @@ calc_part_h_binary (void const * const priv, size_t const n_sites,
   
   for (i = 0; i < n_sites; ++i)
       h += J[i] * spins[k] * spins[sites[i]];
+  h += 2 * (spins[k] * site_field (field, k) + field->aniso);
   
   return -h;
 }
@@ -119,12 +139,71 @@ calc_phi (void const * const priv, size_t const N)
 {
   spin_t const * const spins = (spin_t*) priv;
   size_t i;
-  float m = 0;
+  long m = 0;
   
+#pragma omp parallel for simd reduction (+:m) if (N >= SPNR_PAR_MIN)
   for (i = 0; i < N; ++i)
     m += spins[i];
   
-  return m / (float) N;
+  return (double) m / N;
+}
+
+static size_t
+n_comps (void const * const priv)
+{
+  return 1;
+}
+
+static void
+get_comps (void const * const priv, float * const comps,
+           size_t const k, size_t const count)
+{
+  spin_t const * const spins = (spin_t*) priv;
+  size_t i;
+  
+  for (i = 0; i < count; ++i)
+    comps[i] = spins[k + i];
+}
+
+static void
+prop_comps (void const * const priv, void const * const prop,
+            float * const comps)
+{
+  *comps = *(spin_t*) prop;
+}
+
+static void
+copy (void * const dst, void const * const src, size_t const N)
+{
+  memcpy (dst, src, N * sizeof (spin_t));
+}
+
+/* one bit per spin, set for +1 */
+static size_t
+pack_size (void const * const priv, size_t const N)
+{
+  return (N + 7) / 8;
+}
+
+static void
+pack (void const * const priv, unsigned char * const buf, size_t const N)
+{
+  spin_t const * const spins = (spin_t*) priv;
+  size_t i;
+  
+  memset (buf, 0, (N + 7) / 8);
+  for (i = 0; i < N; ++i)
+    buf[i / 8] |= (spins[i] > 0) << (i % 8);
+}
+
+static void
+unpack (void * const priv, unsigned char const * const buf, size_t const N)
+{
+  spin_t * const spins = (spin_t*) priv;
+  size_t i;
+  
+  for (i = 0; i < N; ++i)
+    spins[i] = (buf[i / 8] >> (i % 8)) & 1 ? 1 : -1;
 }
 
 static const spnr_sys_kind_t ising_kind =
@@ -139,7 +218,15 @@ static const spnr_sys_kind_t ising_kind =
   &accept_prop,
   &calc_delta_h_binary,
   &calc_part_h_binary,
-  &calc_phi
+  &calc_phi,
+  &n_comps,
+  &get_comps,
+  &prop_comps,
+  &copy,
+  &pack_size,
+  &pack,
+  &unpack,
+  NULL
 };
 
-const spnr_sys_kind_t *spnr_ising = &ising_kind;
\ No newline at end of file
+const spnr_sys_kind_t *spnr_ising = &ising_kind;
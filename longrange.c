@@ -0,0 +1,578 @@
+/* longrange.c
+ * 
+ * Copyright (C) 2024 L. Bertini
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "spinner.h"
+#include "error.h"
+#include "internal.h"
+#include "fft.h"
+#include "rng.h"
+#include "stats.h"
+#include "graphio.h"
+
+/* Power-law interaction J/r^alpha on a periodic hypercubic lattice.
+ *
+ * Since the couplings only depend on the displacement between two
+ * sites, a single array of N values (the kernel) is stored instead of
+ * N^2 couplings, and all the local fields are obtained at once as the
+ * convolution of the spin field with the kernel, computed via FFT.
+ * With n_images = 0 the minimum image distance is used; otherwise the
+ * periodic images up to n_images boxes away in each direction are
+ * summed explicitly, which converges for alpha > D. */
+
+typedef struct
+{
+  size_t L;
+  size_t D;
+  size_t N;
+
+  float J;
+  float alpha;
+  size_t n_images;
+
+  float *kernel;
+  double *kernel_ft;
+  int mapped;
+} lr_priv_t;
+
+/* saved graph: this header, then the kernel and its transform */
+typedef union
+{
+  struct
+  {
+    uint64_t L;
+    uint64_t D;
+    float J;
+    float alpha;
+    uint64_t n_images;
+  } h;
+  char pad[SPNR_FILE_ALIGN];
+} lr_file_t;
+
+static size_t
+disp_index (lr_priv_t const * const priv, size_t const i, size_t const j)
+{
+  size_t d, xi, xj, r = 0, unit = 1;
+  size_t const L = priv->L;
+
+  for (d = 0; d < priv->D; ++d, unit *= L)
+    {
+      xi = (i / unit) % L;
+      xj = (j / unit) % L;
+      r += ((xi + L - xj) % L) * unit;
+    }
+
+  return r;
+}
+
+static void
+kernel_build (lr_priv_t * const priv)
+{
+  size_t r, d, m, t, unit, n_img;
+  size_t const L = priv->L, D = priv->D, N = priv->N;
+  size_t const width = 2 * priv->n_images + 1;
+  long c[SPNR_DIMS_MAX];
+  double x, dist2, sum;
+  double *im;
+
+  for (d = 0, n_img = 1; d < D; ++d)
+    n_img *= width;
+
+  for (r = 0; r < N; ++r)
+    {
+      for (d = 0, unit = 1; d < D; ++d, unit *= L)
+        {
+          c[d] = (r / unit) % L;
+          if (c[d] > (long) L / 2)
+            c[d] -= L;
+        }
+
+      sum = 0;
+      for (m = 0; r != 0 && m < n_img; ++m)
+        {
+          dist2 = 0;
+          for (d = 0, t = m; d < D; ++d, t /= width)
+            {
+              x = c[d] + ((long) (t % width) - (long) priv->n_images) * (long) L;
+              dist2 += x * x;
+            }
+          sum += pow (dist2, -0.5 * priv->alpha);
+        }
+      priv->kernel[r] = priv->J * sum;
+    }
+
+  im = malloc_err (N * sizeof (double));
+  for (r = 0; r < N; ++r)
+    {
+      priv->kernel_ft[r] = priv->kernel[r];
+      im[r] = 0;
+    }
+  spnr_fft_nd (priv->kernel_ft, im, L, D, SPNR_FALSE);
+  free_err (im);
+}
+
+static void *
+priv_alloc (spnr_getter_t const getter, spnr_getter_args_t const * const args,
+            size_t const N, size_t const D)
+{
+  size_t i, n;
+  lr_priv_t *priv;
+
+  if (D <= 0 || D > SPNR_DIMS_MAX)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "graph parameters out of bounds");
+
+  priv = malloc_err (sizeof (lr_priv_t));
+  priv->L = nearbyintf (pow (N, 1.0/D));
+  priv->D = D;
+  priv->N = N;
+
+  for (i = 0, n = 1; i < D; ++i)
+    n *= priv->L;
+  if (n != N)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "N is not the D-th power of an integer");
+
+  priv->J = getter (args, 0);
+  priv->alpha = D + 1;
+  priv->n_images = 0;
+  priv->kernel = malloc_err (N * sizeof (float));
+  priv->kernel_ft = malloc_err (N * sizeof (double));
+  priv->mapped = SPNR_FALSE;
+
+  kernel_build (priv);
+
+  return priv;
+}
+
+static void
+priv_free (void * const priv)
+{
+  lr_priv_t *priv_ = (lr_priv_t*) priv;
+  if (!priv_->mapped)
+    {
+      free_err (priv_->kernel);
+      free_err (priv_->kernel_ft);
+    }
+  free_err (priv_);
+}
+
+static void
+save (void const * const priv, size_t const N, FILE * const f)
+{
+  lr_priv_t const * const priv_ = (lr_priv_t *) priv;
+  lr_file_t hdr;
+
+  memset (&hdr, 0, sizeof (hdr));
+  hdr.h.L = priv_->L;
+  hdr.h.D = priv_->D;
+  hdr.h.J = priv_->J;
+  hdr.h.alpha = priv_->alpha;
+  hdr.h.n_images = priv_->n_images;
+  spnr_file_write (f, &hdr, sizeof (hdr));
+  spnr_file_write (f, priv_->kernel, N * sizeof (float));
+  spnr_file_write (f, priv_->kernel_ft, N * sizeof (double));
+}
+
+/* the kernels are used in place, read-only */
+static void *
+map (void const * const data, size_t const len, size_t const N)
+{
+  lr_file_t const * const hdr = (lr_file_t const *) data;
+  lr_priv_t * const priv = malloc_err (sizeof (lr_priv_t));
+  size_t const kernel_len = spnr_file_round (N * sizeof (float));
+
+  if (len < sizeof (lr_file_t) + kernel_len + N * sizeof (double))
+    spnr_err (SPNR_FAILURE, "truncated graph file");
+
+  priv->L = hdr->h.L;
+  priv->D = hdr->h.D;
+  priv->N = N;
+  priv->J = hdr->h.J;
+  priv->alpha = hdr->h.alpha;
+  priv->n_images = hdr->h.n_images;
+  priv->kernel = (float *) (hdr + 1);
+  priv->kernel_ft = (double *) ((char *) priv->kernel + kernel_len);
+  priv->mapped = SPNR_TRUE;
+
+  return priv;
+}
+
+static size_t
+dims (void const * const priv, size_t * const L)
+{
+  lr_priv_t const * const priv_ = (lr_priv_t *) priv;
+  *L = priv_->L;
+  return priv_->D;
+}
+
+/* computes the local fields of every site from the n components of the
+ * spins in comps, two components at a time: the kernel is real and
+ * symmetric, so the real and imaginary parts convolve independently */
+static void
+calc_fields (lr_priv_t const * const priv, float const * const comps,
+             size_t const n, double * const fields,
+             double * const re, double * const im)
+{
+  size_t i, c;
+  size_t const N = priv->N;
+
+  for (c = 0; c < n; c += 2)
+    {
+      for (i = 0; i < N; ++i)
+        {
+          re[i] = comps[i * n + c];
+          im[i] = (c + 1 < n) ? comps[i * n + c + 1] : 0;
+        }
+
+      spnr_fft_nd (re, im, priv->L, priv->D, SPNR_FALSE);
+      for (i = 0; i < N; ++i)
+        {
+          re[i] *= priv->kernel_ft[i];
+          im[i] *= priv->kernel_ft[i];
+        }
+      spnr_fft_nd (re, im, priv->L, priv->D, SPNR_TRUE);
+
+      for (i = 0; i < N; ++i)
+        {
+          fields[i * n + c] = re[i];
+          if (c + 1 < n)
+            fields[i * n + c + 1] = im[i];
+        }
+    }
+}
+
+/* adds the single-site field acting on site k to hk */
+static void
+add_site_field (double * const hk, spnr_field_t const * const field,
+                size_t const n, size_t const k)
+{
+  size_t c;
+
+  if (field->uniform)
+    for (c = 0; c < n; ++c)
+      hk[c] += field->uniform[c];
+  if (field->site)
+    for (c = 0; c < n; ++c)
+      hk[c] += field->site[k * n + c];
+}
+
+/* direct O(N) evaluation, used by the generic steppers */
+static float
+calc_delta_h (void const * const priv,
+              spnr_sys_t const * const sys,
+              void const * const prop,
+              size_t const k)
+{
+  lr_priv_t const * const priv_ = (lr_priv_t *) priv;
+  size_t j, jj, c, count;
+  size_t const N = priv_->N;
+  size_t const n = sys->kind->n_comps (sys->priv);
+  float K;
+  float buf[SPNR_CHUNK * SPNR_OBS_COMPS_MAX];
+  float sk[SPNR_OBS_COMPS_MAX], pk[SPNR_OBS_COMPS_MAX];
+  double hk[SPNR_OBS_COMPS_MAX];
+  double h = 0;
+
+  if (n > SPNR_OBS_COMPS_MAX)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "too many spin components");
+
+  memset (hk, 0, sizeof (hk));
+  for (j = 0; j < N; j += SPNR_CHUNK)
+    {
+      count = (N - j < SPNR_CHUNK) ? N - j : SPNR_CHUNK;
+      sys->kind->get_comps (sys->priv, buf, j, count);
+      for (jj = 0; jj < count; ++jj)
+        {
+          K = priv_->kernel[disp_index (priv_, j + jj, k)];
+          for (c = 0; c < n; ++c)
+            hk[c] += K * buf[jj * n + c];
+        }
+    }
+
+  add_site_field (hk, &sys->field, n, k);
+  sys->kind->get_comps (sys->priv, sk, k, 1);
+  sys->kind->prop_comps (sys->priv, prop, pk);
+  for (c = 0; c < n; ++c)
+    h += (sk[c] - pk[c]) * hk[c];
+  h += sys->field.aniso * (sk[0] * sk[0] - pk[0] * pk[0]);
+
+  return h;
+}
+
+static float
+calc_h (void const * const priv, size_t const N, spnr_sys_t const * const sys)
+{
+  lr_priv_t const * const priv_ = (lr_priv_t *) priv;
+  size_t i, c;
+  size_t const n = sys->kind->n_comps (sys->priv);
+  spnr_field_t const * const field = &sys->field;
+  float *comps = malloc_err (N * n * sizeof (float));
+  double *fields = malloc_err (N * n * sizeof (double));
+  double *re = malloc_err (N * sizeof (double));
+  double *im = malloc_err (N * sizeof (double));
+  double h = 0;
+
+  sys->kind->get_comps (sys->priv, comps, 0, N);
+  calc_fields (priv_, comps, n, fields, re, im);
+
+  /* the pair fields are halved to count each bond once, the
+   * single-site ones are added twice to compensate */
+  for (i = 0; i < N; ++i)
+    {
+      for (c = 0; c < n; ++c)
+        {
+          if (field->uniform)
+            fields[i * n + c] += 2 * field->uniform[c];
+          if (field->site)
+            fields[i * n + c] += 2 * field->site[i * n + c];
+        }
+      fields[i * n] += 2 * field->aniso * comps[i * n];
+    }
+
+  for (i = 0; i < N * n; ++i)
+    h += comps[i] * fields[i];
+
+  free_err (comps);
+  free_err (fields);
+  free_err (re);
+  free_err (im);
+
+  return -0.5 * h / N;
+}
+
+void
+spnr_graph_lr_set (spnr_graph_t * const graph, float const alpha,
+                   size_t const n_images)
+{
+  lr_priv_t * const priv = (lr_priv_t *) graph->priv;
+
+  if (graph->kind != spnr_powerlaw)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "graph is not a long range graph");
+  if (priv->mapped)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "mapped graphs are read-only");
+
+  priv->alpha = alpha;
+  priv->n_images = n_images;
+  kernel_build (priv);
+}
+
+static const spnr_graph_kind_t powerlaw_kind =
+{
+  "powerlaw",
+  &priv_alloc,
+  &priv_free,
+  &calc_delta_h,
+  &calc_h,
+  &save,
+  &map,
+  &dims,
+  NULL,
+  NULL,
+  NULL,
+  NULL
+};
+
+const spnr_graph_kind_t *spnr_powerlaw = &powerlaw_kind;
+
+/* Long range Metropolis stepper
+ *
+ * Sweeps the sites in order, reading the local fields from a cache
+ * refreshed by FFT at the beginning of each sweep. Accepted moves are
+ * kept in a pending list whose contribution is added to the cached
+ * fields explicitly, and the cache is refreshed again when the list
+ * grows beyond ~sqrt(N log N) entries; every proposal thus sees the
+ * exact local field. */
+
+typedef struct
+{
+  void *prop;
+
+  size_t N;
+  size_t n;
+  size_t max_pend;
+  float acc_rate;
+
+  float *comps;
+  double *fields;
+  double *re;
+  double *im;
+  size_t *pend_sites;
+  float *pend_delta;
+} lr_step_priv_t;
+
+static void *
+step_priv_alloc (size_t const spin_size)
+{
+  lr_step_priv_t * const priv = malloc_err (sizeof (lr_step_priv_t));
+
+  priv->prop = malloc_err (spin_size);
+  priv->N = 0;
+  priv->n = 0;
+  priv->acc_rate = NAN;
+  priv->comps = NULL;
+  priv->fields = NULL;
+  priv->re = NULL;
+  priv->im = NULL;
+  priv->pend_sites = NULL;
+  priv->pend_delta = NULL;
+
+  return priv;
+}
+
+static void
+step_priv_free_bufs (lr_step_priv_t * const priv)
+{
+  free_err (priv->comps);
+  free_err (priv->fields);
+  free_err (priv->re);
+  free_err (priv->im);
+  free_err (priv->pend_sites);
+  free_err (priv->pend_delta);
+}
+
+static void
+step_priv_free (void * const priv)
+{
+  lr_step_priv_t * const priv_ = (lr_step_priv_t *) priv;
+  step_priv_free_bufs (priv_);
+  free_err (priv_->prop);
+  free_err (priv_);
+}
+
+static void
+step_priv_resize (lr_step_priv_t * const priv, size_t const N,
+                  size_t const n)
+{
+  if (priv->N == N && priv->n == n)
+    return;
+
+  step_priv_free_bufs (priv);
+  priv->N = N;
+  priv->n = n;
+  priv->max_pend = ceil (sqrt (N * log2 (N + 1)));
+  priv->comps = malloc_err (N * n * sizeof (float));
+  priv->fields = malloc_err (N * n * sizeof (double));
+  priv->re = malloc_err (N * sizeof (double));
+  priv->im = malloc_err (N * sizeof (double));
+  priv->pend_sites = malloc_err (priv->max_pend * sizeof (size_t));
+  priv->pend_delta = malloc_err (priv->max_pend * n * sizeof (float));
+}
+
+static int
+lr_prop_accept (float const delta_h, float const beta)
+{
+  if (delta_h <= 0)
+    return SPNR_TRUE;
+  else
+    return spnr_rng_unif () < exp (- beta * delta_h);
+}
+
+static void
+step_apply (void * const priv, spnr_sys_t const * const sys,
+            float const beta)
+{
+  lr_step_priv_t * const st = (lr_step_priv_t *) priv;
+  spnr_graph_t const * const graph = sys->graph;
+  lr_priv_t const * const lr = (lr_priv_t *) graph->priv;
+  size_t k, c, p, n_pend, n_acc = 0;
+  size_t const N = graph->N;
+  size_t const n = sys->kind->n_comps (sys->priv);
+  float K;
+  float *sk;
+  float pk[SPNR_OBS_COMPS_MAX];
+  double hk[SPNR_OBS_COMPS_MAX];
+  double delta_h;
+  SPNR_STATS_VAR (t);
+
+  if (graph->kind != spnr_powerlaw)
+    spnr_err (SPNR_ERROR_FUNC_NULL, "stepper needs a long range graph");
+  if (n > SPNR_OBS_COMPS_MAX)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "too many spin components");
+
+  step_priv_resize (st, N, n);
+  sys->kind->get_comps (sys->priv, st->comps, 0, N);
+  calc_fields (lr, st->comps, n, st->fields, st->re, st->im);
+  n_pend = 0;
+
+  SPNR_STATS_TIC (t);
+  for (k = 0; k < N; ++k)
+    {
+      sys->kind->fill_prop (sys->priv, st->prop, k);
+      sys->kind->prop_comps (sys->priv, st->prop, pk);
+      SPNR_STATS_LAP (t, SPNR_PHASE_PROP);
+      sk = st->comps + k * n;
+
+      for (c = 0; c < n; ++c)
+        hk[c] = st->fields[k * n + c];
+      add_site_field (hk, &sys->field, n, k);
+      for (p = 0; p < n_pend; ++p)
+        {
+          K = lr->kernel[disp_index (lr, k, st->pend_sites[p])];
+          for (c = 0; c < n; ++c)
+            hk[c] += K * st->pend_delta[p * n + c];
+        }
+
+      delta_h = sys->field.aniso * (sk[0] * sk[0] - pk[0] * pk[0]);
+      for (c = 0; c < n; ++c)
+        delta_h += (sk[c] - pk[c]) * hk[c];
+      SPNR_STATS_LAP (t, SPNR_PHASE_DELTA_H);
+
+      if (lr_prop_accept (delta_h, beta))
+        {
+          sys->kind->accept_prop (sys->priv, st->prop, k);
+          ++n_acc;
+          st->pend_sites[n_pend] = k;
+          for (c = 0; c < n; ++c)
+            {
+              st->pend_delta[n_pend * n + c] = pk[c] - sk[c];
+              sk[c] = pk[c];
+            }
+
+          if (++n_pend == st->max_pend)
+            {
+              calc_fields (lr, st->comps, n, st->fields, st->re, st->im);
+              n_pend = 0;
+            }
+        }
+      SPNR_STATS_LAP (t, SPNR_PHASE_ACCEPT);
+    }
+
+  st->acc_rate = (float) n_acc / N;
+  SPNR_STATS_ADD (n_prop, N);
+  SPNR_STATS_ADD (n_acc, n_acc);
+}
+
+static float
+step_acc_rate (void const * const priv)
+{
+  return ((lr_step_priv_t const *) priv)->acc_rate;
+}
+
+static const spnr_step_kind_t lr_metropolis_kind =
+{
+  "lr_metropolis",
+  &step_priv_alloc,
+  &step_priv_free,
+  &step_apply,
+  &step_acc_rate
+};
+
+const spnr_step_kind_t *spnr_lr_metropolis = &lr_metropolis_kind;
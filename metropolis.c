@@ -17,32 +17,75 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
  */
 
+#include <stdint.h>
+#include <string.h>
 #include <math.h>
 
 #include "spinner.h"
 #include "error.h"
+#include "internal.h"
+#include "rng.h"
+#include "stats.h"
+
+/* The acceptance ratios are memoized in a small direct-mapped table
+ * keyed on the exact value of delta_h. Discrete spectra (Ising, Potts
+ * and clock models with uniform couplings) only ever produce a handful
+ * of distinct values and hit the table almost always. Continuous ones
+ * would compute the exponential on every move, so kinds with batched
+ * proposals (fill_props) draw SPNR_BATCH of them at a time, together
+ * with exponential variates e, and a move is accepted when beta delta_h
+ * <= e. Both come from vectorized generators, and the proposals do not
+ * depend on the state, so drawing them ahead is exact. */
+
+typedef struct
+{
+  size_t spin_size;
+  void *prop;
+  float beta;
+  float acc_rate;
+  float lut_delta_h[SPNR_METR_LUT_SIZE];
+  float lut_acc[SPNR_METR_LUT_SIZE];
+} metr_priv_t;
+
+static void
+lut_reset (metr_priv_t * const priv, float const beta)
+{
+  size_t i;
+  
+  priv->beta = beta;
+  for (i = 0; i < SPNR_METR_LUT_SIZE; ++i)
+    priv->lut_delta_h[i] = NAN;
+}
 
 static void *
 priv_alloc (size_t const spin_size)
 {
-  return malloc_err (spin_size);
+  metr_priv_t * const priv = malloc_err (sizeof (metr_priv_t));
+  priv->spin_size = spin_size;
+  priv->prop = malloc_err (SPNR_BATCH * spin_size);
+  priv->acc_rate = NAN;
+  lut_reset (priv, NAN);
+  return priv;
 }
 
 static void
 priv_free (void * priv)
 {
-  free (priv);
+  metr_priv_t * const priv_ = (metr_priv_t *) priv;
+  free_err (priv_->prop);
+  free_err (priv_);
 }
 
 static int
-metr_prop_accept (float const delta_h, float const beta)
+metr_prop_accept (metr_priv_t * const priv, float const delta_h)
 {
   if (delta_h <= 0)
     return SPNR_TRUE;
   else
     {
-      float acc_ratio = exp (- beta * delta_h);
-      float rand_num = (float) rand () / RAND_MAX;
+      float acc_ratio = spnr_lut_acc_ratio (priv->lut_delta_h, priv->lut_acc,
+                                            priv->beta, delta_h);
+      float rand_num = spnr_rng_unif ();
       if (rand_num < acc_ratio)
         return SPNR_TRUE;
       else
@@ -50,27 +93,99 @@ metr_prop_accept (float const delta_h, float const beta)
   }
 }
 
+static size_t
+sweep_batched (metr_priv_t * const priv, spnr_sys_t const * const sys,
+               float const beta)
+{
+  spnr_graph_t const * const graph = sys->graph;
+  size_t const N = graph->N;
+  unsigned char * const props = priv->prop;
+  float e[SPNR_BATCH];
+  size_t b, i, k, m, n_acc = 0;
+  float delta_h;
+  SPNR_STATS_VAR (t);
+  
+  SPNR_STATS_TIC (t);
+  for (b = 0; b < N; b += m)
+    {
+      m = N - b < SPNR_BATCH ? N - b : SPNR_BATCH;
+      sys->kind->fill_props (sys->priv, props, m);
+      spnr_rng_fill_exp (e, m);
+      SPNR_STATS_LAP (t, SPNR_PHASE_PROP);
+      
+      for (i = 0; i < m; ++i)
+        {
+          k = spnr_rng_int (N);
+          delta_h = graph->kind->calc_delta_h (graph->priv, sys,
+                                               props + i * priv->spin_size,
+                                               k);
+          SPNR_STATS_LAP (t, SPNR_PHASE_DELTA_H);
+          
+          if (delta_h <= 0 || beta * delta_h <= e[i])
+            {
+              sys->kind->accept_prop (sys->priv,
+                                      props + i * priv->spin_size, k);
+              ++n_acc;
+            }
+          SPNR_STATS_LAP (t, SPNR_PHASE_ACCEPT);
+        }
+    }
+  
+  return n_acc;
+}
 
-/* here priv is not a struct but holds the proposed value */
-void
-apply (void * const priv, spnr_sys_t const * const sys,
+static size_t
+sweep (metr_priv_t * const priv, spnr_sys_t const * const sys,
        float const beta)
 {
   spnr_graph_t const * const graph = sys->graph;
-  size_t i, k;
+  size_t i, k, n_acc = 0;
   size_t const N = graph->N;
-  void *prop;
+  void * const prop = priv->prop;
   float delta_h;
+  SPNR_STATS_VAR (t);
   
+  if (priv->beta != beta)
+    lut_reset (priv, beta);
+  
+  SPNR_STATS_TIC (t);
   for (i = 0; i < N; ++i)
     {
-      k = rand() % N;
-      sys->kind->fill_prop (sys->priv, priv, k);
-      delta_h = graph->kind->calc_delta_h (graph->priv, sys, priv, k);
+      k = spnr_rng_int (N);
+      sys->kind->fill_prop (sys->priv, prop, k);
+      SPNR_STATS_LAP (t, SPNR_PHASE_PROP);
+      delta_h = graph->kind->calc_delta_h (graph->priv, sys, prop, k);
+      SPNR_STATS_LAP (t, SPNR_PHASE_DELTA_H);
       
-      if (metr_prop_accept (delta_h, beta))
-        sys->kind->accept_prop (sys->priv, priv, k);
+      if (metr_prop_accept (priv, delta_h))
+        {
+          sys->kind->accept_prop (sys->priv, prop, k);
+          ++n_acc;
+        }
+      SPNR_STATS_LAP (t, SPNR_PHASE_ACCEPT);
     }
+  
+  return n_acc;
+}
+
+void
+apply (void * const priv, spnr_sys_t const * const sys,
+       float const beta)
+{
+  metr_priv_t * const priv_ = (metr_priv_t *) priv;
+  size_t const N = sys->graph->N;
+  size_t const n_acc = sys->kind->fill_props
+    ? sweep_batched (priv_, sys, beta) : sweep (priv_, sys, beta);
+  
+  priv_->acc_rate = (float) n_acc / N;
+  SPNR_STATS_ADD (n_prop, N);
+  SPNR_STATS_ADD (n_acc, n_acc);
+}
+
+static float
+acc_rate (void const * const priv)
+{
+  return ((metr_priv_t const *) priv)->acc_rate;
 }
 
 static const spnr_step_kind_t metropolis_kind =
@@ -78,7 +193,8 @@ static const spnr_step_kind_t metropolis_kind =
   "metropolis",
   &priv_alloc,
   &priv_free,
-  &apply
+  &apply,
+  &acc_rate
 };
 
 const spnr_step_kind_t *spnr_metropolis = &metropolis_kind;
\ No newline at end of file
@@ -0,0 +1,288 @@
+/* nfold.c
+ * 
+ * Copyright (C) 2024 L. Bertini
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdint.h>
+#include <math.h>
+
+#include "spinner.h"
+#include "error.h"
+#include "rng.h"
+#include "stats.h"
+
+/* n-fold way (Bortz, Kalos and Lebowitz)
+ *
+ * Every site carries its Metropolis flip rate min(1, exp(-beta dH)),
+ * and the rates are summed in a Fenwick tree: the next spin to flip is
+ * drawn with probability proportional to its rate in O(log N), and the
+ * clock advances by an exponential waiting time of mean 1 / sum. After
+ * a flip only the rates of the site and of its neighbors change. The
+ * event that would cross the end of the sweep is dropped, which is
+ * exact since the waiting times are memoryless. The tree is rebuilt
+ * from the rates every N updates so that rounding errors do not pile
+ * up. The rates are cached for one system, beta and field, and rebuilt
+ * when any of them changes. */
+
+typedef struct
+{
+  void *prop;
+  spnr_sys_t const *sys;
+  float beta;
+  size_t N;
+  float h;
+  float const *h_site;
+  float aniso;
+  double *rate;
+  double *tree;
+  double total;
+  size_t n_updates;
+  double time;
+  float acc_rate;
+} nfold_priv_t;
+
+static void *
+priv_alloc (size_t const spin_size)
+{
+  nfold_priv_t * const priv = malloc_err (sizeof (nfold_priv_t));
+  priv->prop = malloc_err (spin_size);
+  priv->sys = NULL;
+  priv->beta = NAN;
+  priv->N = 0;
+  priv->h = 0;
+  priv->h_site = NULL;
+  priv->aniso = 0;
+  priv->rate = NULL;
+  priv->tree = NULL;
+  priv->time = 0;
+  priv->acc_rate = NAN;
+  return priv;
+}
+
+static void
+priv_free (void * const priv)
+{
+  nfold_priv_t * const priv_ = (nfold_priv_t *) priv;
+  free_err (priv_->prop);
+  free_err (priv_->rate);
+  free_err (priv_->tree);
+  free_err (priv_);
+}
+
+/* uniform in [0, 1) with the full double resolution, needed to pick one
+ * site out of millions */
+static double
+unif53 (void)
+{
+  return (spnr_rng_next () >> 11) * 0x1p-53;
+}
+
+static double
+site_rate (nfold_priv_t * const priv, spnr_sys_t const * const sys,
+           size_t const k)
+{
+  spnr_graph_t const * const graph = sys->graph;
+  float delta_h;
+
+  sys->kind->fill_prop (sys->priv, priv->prop, k);
+  delta_h = graph->kind->calc_delta_h (graph->priv, sys, priv->prop, k);
+
+  return delta_h <= 0 ? 1.0 : exp (- priv->beta * delta_h);
+}
+
+/* tree[i] holds the sum of the rates of sites (i - (i & -i), i - 1] */
+static void
+tree_build (nfold_priv_t * const priv)
+{
+  size_t i, j;
+  size_t const N = priv->N;
+
+  for (i = 1; i <= N; ++i)
+    priv->tree[i] = priv->rate[i - 1];
+  for (i = 1; i <= N; ++i)
+    {
+      j = i + (i & -i);
+      if (j <= N)
+        priv->tree[j] += priv->tree[i];
+    }
+
+  priv->total = 0;
+  for (i = N; i; i -= i & -i)
+    priv->total += priv->tree[i];
+  priv->n_updates = 0;
+}
+
+static void
+tree_set (nfold_priv_t * const priv, size_t const k, double const rate)
+{
+  size_t i;
+  double const d = rate - priv->rate[k];
+
+  priv->rate[k] = rate;
+  for (i = k + 1; i <= priv->N; i += i & -i)
+    priv->tree[i] += d;
+  priv->total += d;
+
+  if (++priv->n_updates >= priv->N)
+    tree_build (priv);
+}
+
+/* the site whose rate interval contains u, 0 <= u < total */
+static size_t
+tree_find (nfold_priv_t const * const priv, double u)
+{
+  size_t pos = 0, step = 1;
+  size_t const N = priv->N;
+
+  while (2 * step <= N)
+    step *= 2;
+  for (; step; step /= 2)
+    if (pos + step <= N && priv->tree[pos + step] <= u)
+      {
+        pos += step;
+        u -= priv->tree[pos];
+      }
+
+  /* rounding can only push u past the last site */
+  return pos < N ? pos : N - 1;
+}
+
+/* Ising spins have a single component, and no uniform field is a zero
+ * one */
+static float
+uniform_field (spnr_sys_t const * const sys)
+{
+  return sys->field.uniform ? sys->field.uniform[0] : 0;
+}
+
+static void
+rebuild (nfold_priv_t * const priv, spnr_sys_t const * const sys,
+         float const beta)
+{
+  size_t k;
+  size_t const N = sys->graph->N;
+
+  if (priv->N != N)
+    {
+      free_err (priv->rate);
+      free_err (priv->tree);
+      priv->rate = malloc_err (N * sizeof (double));
+      priv->tree = malloc_err ((N + 1) * sizeof (double));
+      priv->N = N;
+    }
+  priv->sys = sys;
+  priv->beta = beta;
+  priv->h = uniform_field (sys);
+  priv->h_site = sys->field.site;
+  priv->aniso = sys->field.aniso;
+
+  for (k = 0; k < N; ++k)
+    priv->rate[k] = site_rate (priv, sys, k);
+  tree_build (priv);
+}
+
+static void
+apply (void * const priv, spnr_sys_t const * const sys, float const beta)
+{
+  nfold_priv_t * const priv_ = (nfold_priv_t *) priv;
+  spnr_graph_t const * const graph = sys->graph;
+  size_t i, k, n_nbrs, n_acc = 0;
+  size_t nbrs[SPNR_NBRS_MAX];
+  double const t_end = priv_->time + 1;
+  double dt;
+  SPNR_STATS_VAR (t);
+
+  if (sys->kind != spnr_ising)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "n-fold way needs Ising spins");
+  if (!graph->kind->get_neighbors)
+    spnr_err (SPNR_ERROR_FUNC_NULL, "n-fold way needs neighbor lists");
+
+  if (priv_->sys != sys || priv_->beta != beta || priv_->N != graph->N
+      || priv_->h != uniform_field (sys) || priv_->h_site != sys->field.site
+      || priv_->aniso != sys->field.aniso)
+    rebuild (priv_, sys, beta);
+
+  SPNR_STATS_TIC (t);
+  for (;;)
+    {
+      if (priv_->total <= 0)
+        break;
+      dt = - log (1 - unif53 ()) / priv_->total;
+      if (priv_->time + dt >= t_end)
+        break;
+      priv_->time += dt;
+
+      k = tree_find (priv_, unif53 () * priv_->total);
+      SPNR_STATS_LAP (t, SPNR_PHASE_PROP);
+
+      sys->kind->fill_prop (sys->priv, priv_->prop, k);
+      sys->kind->accept_prop (sys->priv, priv_->prop, k);
+      ++n_acc;
+      SPNR_STATS_LAP (t, SPNR_PHASE_ACCEPT);
+
+      tree_set (priv_, k, site_rate (priv_, sys, k));
+      n_nbrs = graph->kind->get_neighbors (graph->priv, k, nbrs);
+      for (i = 0; i < n_nbrs; ++i)
+        tree_set (priv_, nbrs[i], site_rate (priv_, sys, nbrs[i]));
+      SPNR_STATS_LAP (t, SPNR_PHASE_DELTA_H);
+    }
+  priv_->time = t_end;
+
+  /* flips per site, the acceptance rate of the equivalent Metropolis
+   * sweep */
+  priv_->acc_rate = (float) n_acc / graph->N;
+  SPNR_STATS_ADD (n_prop, n_acc);
+  SPNR_STATS_ADD (n_acc, n_acc);
+}
+
+static float
+acc_rate (void const * const priv)
+{
+  return ((nfold_priv_t const *) priv)->acc_rate;
+}
+
+static const spnr_step_kind_t nfold_kind =
+{
+  "nfold",
+  &priv_alloc,
+  &priv_free,
+  &apply,
+  &acc_rate
+};
+
+const spnr_step_kind_t *spnr_nfold = &nfold_kind;
+
+static nfold_priv_t *
+nfold_priv (spnr_step_t const * const step)
+{
+  if (step->kind != spnr_nfold)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "stepper is not an n-fold way stepper");
+  return (nfold_priv_t *) step->priv;
+}
+
+/* continuous time elapsed, in sweeps */
+double
+spnr_nfold_time (spnr_step_t const * const step)
+{
+  return nfold_priv (step)->time;
+}
+
+void
+spnr_nfold_reset (spnr_step_t * const step)
+{
+  nfold_priv (step)->sys = NULL;
+}
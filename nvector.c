@@ -24,9 +24,11 @@
 
 #include "spinner.h"
 #include "error.h"
+#include "internal.h"
+#include "rng.h"
 
 #define SPNR_NVECTOR_D_MAX  8
-#define SPNR_PI             3.1415926536
+#define SPNR_NVECTOR_QUANT  32767
 
 typedef float spin_t;
 
@@ -40,8 +42,8 @@ nvector_priv_t;
 static float
 rand_gauss ()
 {
-  static int has_prev = 0;
-  static float prev_rand;
+  static _Thread_local int has_prev = 0;
+  static _Thread_local float prev_rand;
   float u, v, x, y;
 
   if (has_prev)
@@ -51,8 +53,8 @@ rand_gauss ()
     }
   else
     {
-      u = (float) rand () / RAND_MAX;
-      v = (float) rand () / RAND_MAX;
+      u = 1 - spnr_rng_unif ();
+      v = spnr_rng_unif ();
       x = sqrt (-2. * log (u)) * sin (2 * SPNR_PI * v);
       y = sqrt (-2. * log (u)) * cos (2 * SPNR_PI * v);
 
@@ -154,9 +156,9 @@ priv_alloc (size_t const N, size_t const n)
   if (n <= 0)
     spnr_err (SPNR_ERROR_PARAM_OOB, "number of components must be positive");
   
-  nvector_priv_t * const priv = malloc (sizeof (nvector_priv_t));
+  nvector_priv_t * const priv = malloc_err (sizeof (nvector_priv_t));
   priv->n = n;
-  priv->spins = malloc (N * n * sizeof (spin_t));
+  priv->spins = malloc_err (N * n * sizeof (spin_t));
   
   set_up (priv, N);
   
@@ -167,15 +169,15 @@ static void
 priv_free (void *priv)
 {
   nvector_priv_t * const priv_ = (nvector_priv_t *)priv;
-  free (priv_->spins);
-  free (priv);
+  free_err (priv_->spins);
+  free_err (priv);
 }
 
 static size_t
 spin_size (void *priv)
 {
   nvector_priv_t *priv_ = (nvector_priv_t *)priv;
-  return sizeof (priv_->n * sizeof(spin_t));
+  return priv_->n * sizeof (spin_t);
 }
 
 static void
@@ -186,6 +188,29 @@ fill_prop (void const * const priv, void * const prop, size_t const k)
   spin_rand (prop, priv_->n);
 }
 
+/* Gaussian components from the vectorized generator, normalized; a
+ * null vector, which has probability 2^-24 at n = 2, is drawn again */
+static void
+fill_props (void const * const priv, void * const props, size_t const count)
+{
+  nvector_priv_t const * const priv_ = (nvector_priv_t*) priv;
+  spin_t * const props_ = (spin_t*) props;
+  size_t const n = priv_->n;
+  size_t i, j;
+  float mod;
+  
+  spnr_rng_fill_gauss (props_, count * n);
+  for (i = 0; i < count; ++i)
+    {
+      mod = spin_mod (props_ + i * n, n);
+      if (mod == 0)
+        spin_rand (props_ + i * n, n);
+      else
+        for (j = 0; j < n; ++j)
+          props_[i * n + j] /= mod;
+    }
+}
+
 static void
 accept_prop (void * const priv, void const * const prop, size_t k)
 {
@@ -197,8 +222,24 @@ accept_prop (void * const priv, void const * const prop, size_t k)
   memcpy (spin_k, prop_, n * sizeof (spin_t));
 }
 
+/* adds the single-site field acting on site k to sum */
+static void
+add_site_field (spin_t * const sum, spnr_field_t const * const field,
+                size_t const n, size_t const k)
+{
+  size_t j;
+  
+  if (field->uniform)
+    for (j = 0; j < n; ++j)
+      sum[j] += field->uniform[j];
+  if (field->site)
+    for (j = 0; j < n; ++j)
+      sum[j] += field->site[k * n + j];
+}
+
 static float
 calc_delta_h_binary (void const * const priv,
+                     spnr_field_t const * const field,
                      size_t const n_sites,
                      float const * const J,
                      size_t const * const sites,
@@ -218,16 +259,20 @@ calc_delta_h_binary (void const * const priv,
   for (i = 0; i < n_sites; ++i)
     for (j = 0; j < n; ++j)
       sum[j] += J[i] * spins[sites[i] * n + j];
+  add_site_field (sum, field, n, k);
   
   h = 0;
   for (j = 0; j < n; ++j)
     h += (spin_k[j] - prop_[j]) * sum[j];
+  h += field->aniso * (spin_k[0] * spin_k[0] - prop_[0] * prop_[0]);
   
   return h;
 }
 
 static float
-calc_part_h_binary (void const * const priv, size_t const n_sites,
+calc_part_h_binary (void const * const priv,
+                    spnr_field_t const * const field,
+                    size_t const n_sites,
                     float const * const J, size_t const * const sites,
                     size_t const k)
 {
@@ -237,15 +282,20 @@ calc_part_h_binary (void const * const priv, size_t const n_sites,
   spin_t *spin_k = spins + k * n;
   float h;
   spin_t sum[SPNR_NVECTOR_D_MAX];
+  spin_t ext[SPNR_NVECTOR_D_MAX];
   
   memset (sum, 0, sizeof (sum));
   for (i = 0; i < n_sites; ++i)
     for (j = 0; j < n; ++j)
       sum[j] += J[i] * spins[sites[i] * n + j];
   
+  memset (ext, 0, sizeof (ext));
+  add_site_field (ext, field, n, k);
+  
   h = 0;
   for (j = 0; j < n; ++j)
-    h += spin_k[j] * sum[j];
+    h += spin_k[j] * (sum[j] + 2 * ext[j]);
+  h += 2 * field->aniso * spin_k[0] * spin_k[0];
   
   return -h;
 }
@@ -256,10 +306,12 @@ calc_phi (void const * const priv, size_t const N)
   nvector_priv_t const * const priv_ = (nvector_priv_t*) priv;
   spin_t *spins = priv_->spins;
   size_t i, j, n = priv_->n;
-  float m;
-  spin_t sum[SPNR_NVECTOR_D_MAX];
+  double m;
+  double sum[SPNR_NVECTOR_D_MAX];
   
   memset (sum, 0, sizeof (sum));
+#pragma omp parallel for private (j) reduction (+:sum[:SPNR_NVECTOR_D_MAX]) \
+  if (N >= SPNR_PAR_MIN)
   for (i = 0; i < N; ++i)
     for (j = 0; j < n; ++j)
       sum[j] += spins[i * n + j];
@@ -268,7 +320,87 @@ calc_phi (void const * const priv, size_t const N)
   for (j = 0; j < n; ++j)
     m += sum[j] * sum[j];
   
-  return sqrt(m) / (float) N;
+  return sqrt(m) / N;
+}
+
+static size_t
+n_comps (void const * const priv)
+{
+  return ((nvector_priv_t*) priv)->n;
+}
+
+static void
+get_comps (void const * const priv, float * const comps,
+           size_t const k, size_t const count)
+{
+  nvector_priv_t const * const priv_ = (nvector_priv_t*) priv;
+  size_t const n = priv_->n;
+  
+  memcpy (comps, priv_->spins + k * n, count * n * sizeof (spin_t));
+}
+
+static void
+prop_comps (void const * const priv, void const * const prop,
+            float * const comps)
+{
+  nvector_priv_t const * const priv_ = (nvector_priv_t*) priv;
+  memcpy (comps, prop, priv_->n * sizeof (spin_t));
+}
+
+static void
+copy (void * const dst, void const * const src, size_t const N)
+{
+  nvector_priv_t * const dst_ = (nvector_priv_t*) dst;
+  nvector_priv_t const * const src_ = (nvector_priv_t*) src;
+  
+  memcpy (dst_->spins, src_->spins, N * src_->n * sizeof (spin_t));
+}
+
+/* components quantized to little endian int16, unit norm back when
+ * unpacking; the angular resolution is about 3e-5 */
+static size_t
+pack_size (void const * const priv, size_t const N)
+{
+  return 2 * N * ((nvector_priv_t*) priv)->n;
+}
+
+static void
+pack (void const * const priv, unsigned char * const buf, size_t const N)
+{
+  nvector_priv_t const * const priv_ = (nvector_priv_t*) priv;
+  size_t i;
+  size_t const size = N * priv_->n;
+  long q;
+  
+  for (i = 0; i < size; ++i)
+    {
+      q = lrintf (priv_->spins[i] * SPNR_NVECTOR_QUANT);
+      buf[2 * i] = q & 0xff;
+      buf[2 * i + 1] = (q >> 8) & 0xff;
+    }
+}
+
+static void
+unpack (void * const priv, unsigned char const * const buf, size_t const N)
+{
+  nvector_priv_t * const priv_ = (nvector_priv_t*) priv;
+  size_t i, j;
+  size_t const n = priv_->n;
+  spin_t * s;
+  float mod;
+  
+  for (i = 0; i < N; ++i)
+    {
+      s = priv_->spins + i * n;
+      for (j = 0; j < n; ++j)
+        s[j] = (short) (buf[2 * (i * n + j)]
+                        | buf[2 * (i * n + j) + 1] << 8);
+      mod = spin_mod (s, n);
+      if (mod == 0)
+        spnr_err (SPNR_ERROR_PARAM_OOB, "null spin in snapshot");
+      for (j = 0; j < n; ++j)
+        s[j] /= mod;
+    }
 }
 
 static const spnr_sys_kind_t nvector_kind =
@@ -283,7 +415,15 @@ static const spnr_sys_kind_t nvector_kind =
   &accept_prop,
   &calc_delta_h_binary,
   &calc_part_h_binary,
-  &calc_phi
+  &calc_phi,
+  &n_comps,
+  &get_comps,
+  &prop_comps,
+  &copy,
+  &pack_size,
+  &pack,
+  &unpack,
+  &fill_props
 };
 
 const spnr_sys_kind_t *spnr_nvector = &nvector_kind;
\ No newline at end of file
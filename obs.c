@@ -0,0 +1,178 @@
+/* obs.c
+ * 
+ * Copyright (C) 2024 L. Bertini
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "spinner.h"
+#include "error.h"
+#include "internal.h"
+
+/* Bulk observables
+ *
+ * The spin components of the whole system are gathered once, then a
+ * single parallel pass accumulates in double precision the
+ * magnetization, the staggered magnetization, the nearest neighbour
+ * correlation and the Fourier sums at the smallest wave vectors
+ * k = 2 pi / L along each lattice direction.
+ *
+ * The neighbours are those of the neighbor lists, which cover every
+ * bond of the stencil lattices; only graphs without lists fall back to
+ * the axial bonds of their dims. The staggered sign is the class of a
+ * two-coloring, so it exists only on bipartite graphs, or the parity
+ * of x_1 + ... + x_D on uncolored graphs with dims and even L. The
+ * Fourier sums use the dims layout. */
+
+static void
+gather_comps (spnr_sys_t const * const sys, float * const comps,
+              size_t const N, size_t const n)
+{
+  size_t i;
+
+#pragma omp parallel for if (N >= SPNR_PAR_MIN)
+  for (i = 0; i < N; i += SPNR_CHUNK)
+    sys->kind->get_comps (sys->priv, comps + i * n, i,
+                          (N - i < SPNR_CHUNK) ? N - i : SPNR_CHUNK);
+}
+
+void
+spnr_sys_calc_obs (spnr_sys_t * const sys, spnr_obs_t * const obs)
+{
+  spnr_graph_t const * const graph = sys->graph;
+  size_t const N = graph->N, n = spnr_sys_n_comps (sys);
+  size_t i, c, d, j, x, unit, D = 0, L = 0, n_nbrs, n_pairs = 0;
+  size_t nbrs[SPNR_NBRS_MAX];
+  int parity, stag_ok;
+  float *comps;
+  double *cos_t, *sin_t;
+  double m[SPNR_OBS_COMPS_MAX], stag[SPNR_OBS_COMPS_MAX];
+  double re[SPNR_DIMS_MAX * SPNR_OBS_COMPS_MAX];
+  double im[SPNR_DIMS_MAX * SPNR_OBS_COMPS_MAX];
+  double nn = 0, sum, dot;
+
+  if (n > SPNR_OBS_COMPS_MAX)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "too many spin components");
+
+  if (graph->kind->dims)
+    D = graph->kind->dims (graph->priv, &L);
+  if (graph->kind->n_colors)
+    stag_ok = graph->kind->n_colors (graph->priv) == 2;
+  else
+    stag_ok = D > 0 && L % 2 == 0;
+
+  comps = malloc_err (N * n * sizeof (float));
+  cos_t = malloc_err ((L + 1) * sizeof (double));
+  sin_t = malloc_err ((L + 1) * sizeof (double));
+  gather_comps (sys, comps, N, n);
+  for (x = 0; x < L; ++x)
+    {
+      cos_t[x] = cos (2 * SPNR_PI * x / L);
+      sin_t[x] = sin (2 * SPNR_PI * x / L);
+    }
+
+  memset (m, 0, sizeof (m));
+  memset (stag, 0, sizeof (stag));
+  memset (re, 0, sizeof (re));
+  memset (im, 0, sizeof (im));
+
+#pragma omp parallel for \
+  private (c, d, j, x, unit, parity, dot, n_nbrs, nbrs) \
+  reduction (+:nn, n_pairs, m[:SPNR_OBS_COMPS_MAX], \
+             stag[:SPNR_OBS_COMPS_MAX], \
+             re[:SPNR_DIMS_MAX * SPNR_OBS_COMPS_MAX], \
+             im[:SPNR_DIMS_MAX * SPNR_OBS_COMPS_MAX]) \
+  if (N >= SPNR_PAR_MIN)
+  for (i = 0; i < N; ++i)
+    {
+      float const * const s = comps + i * n;
+
+      if (graph->kind->get_neighbors)
+        {
+          n_nbrs = graph->kind->get_neighbors (graph->priv, i, nbrs);
+          for (j = 0; j < n_nbrs; ++j)
+            for (c = 0; c < n; ++c)
+              nn += s[c] * comps[nbrs[j] * n + c];
+          n_pairs += n_nbrs;
+        }
+
+      for (d = 0, unit = 1, parity = 0; d < D; ++d, unit *= L)
+        {
+          x = (i / unit) % L;
+          parity ^= x & 1;
+
+          /* forward neighbour along d, each bond counted once */
+          if (!graph->kind->get_neighbors)
+            {
+              j = (x + 1 < L) ? i + unit : i + unit - L * unit;
+              for (c = 0, dot = 0; c < n; ++c)
+                dot += s[c] * comps[j * n + c];
+              nn += dot;
+              ++n_pairs;
+            }
+
+          for (c = 0; c < n; ++c)
+            {
+              re[d * n + c] += s[c] * cos_t[x];
+              im[d * n + c] -= s[c] * sin_t[x];
+            }
+        }
+
+      if (graph->kind->n_colors && stag_ok)
+        parity = graph->kind->color (graph->priv, i);
+      for (c = 0; c < n; ++c)
+        {
+          m[c] += s[c];
+          stag[c] += parity ? -s[c] : s[c];
+        }
+    }
+
+  obs->n_comps = n;
+  obs->e = spnr_sys_calc_h (sys);
+
+  for (c = 0, sum = 0; c < n; ++c)
+    {
+      obs->m[c] = m[c] / N;
+      sum += obs->m[c] * obs->m[c];
+    }
+  obs->m_abs = sqrt (sum);
+
+  if (stag_ok)
+    {
+      for (c = 0, sum = 0; c < n; ++c)
+        sum += stag[c] * stag[c];
+      obs->m_stag = sqrt (sum) / N;
+    }
+  else
+    obs->m_stag = NAN;
+
+  obs->nn_corr = n_pairs ? nn / n_pairs : NAN;
+
+  if (D > 0)
+    {
+      for (d = 0, sum = 0; d < D * n; ++d)
+        sum += re[d] * re[d] + im[d] * im[d];
+      obs->s_kmin = sum / (N * D);
+    }
+  else
+    obs->s_kmin = NAN;
+
+  free_err (comps);
+  free_err (cos_t);
+  free_err (sin_t);
+}
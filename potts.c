@@ -0,0 +1,371 @@
+/* potts.c
+ * 
+ * Copyright (C) 2024 L. Bertini
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "spinner.h"
+#include "error.h"
+#include "internal.h"
+#include "rng.h"
+
+#define SPNR_POTTS_Q_MAX 256
+
+/* Potts and clock models share the same storage: each spin is one of q
+ * integer states, and the pair interaction between states a and b is
+ * read from a precomputed q x q table, delta(a, b) for the Potts model
+ * and cos(2 pi (a - b) / q) for the clock model. The comps table holds
+ * the vector embedding of each state (one-hot for Potts, a unit vector
+ * on the circle for clock), so that table[a][b] = comps[a] . comps[b] */
+
+typedef uint8_t spin_t;
+
+typedef struct
+{
+  size_t q;
+  size_t n;
+  spin_t *spins;
+  float *table;
+  float *comps;
+}
+potts_priv_t;
+
+static void
+set_up (void * const priv, size_t const N)
+{
+  potts_priv_t * const priv_ = (potts_priv_t *) priv;
+  memset (priv_->spins, 0, N * sizeof (spin_t));
+}
+
+static void
+set_rand (void * const priv, size_t const N)
+{
+  potts_priv_t * const priv_ = (potts_priv_t *) priv;
+  size_t i;
+  
+  for (i = 0; i < N; ++i)
+    priv_->spins[i] = spnr_rng_int (priv_->q);
+}
+
+static potts_priv_t *
+priv_alloc_common (size_t const N, size_t const q, size_t const n)
+{
+  potts_priv_t *priv;
+  
+  if (q < 2 || q > SPNR_POTTS_Q_MAX)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "number of states out of bounds");
+  
+  priv = malloc_err (sizeof (potts_priv_t));
+  priv->q = q;
+  priv->n = n;
+  priv->spins = malloc_err (N * sizeof (spin_t));
+  priv->table = malloc_err (q * q * sizeof (float));
+  priv->comps = malloc_err (q * n * sizeof (float));
+  memset (priv->comps, 0, q * n * sizeof (float));
+  
+  set_up (priv, N);
+  
+  return priv;
+}
+
+static void *
+potts_priv_alloc (size_t const N, size_t const q)
+{
+  potts_priv_t * const priv = priv_alloc_common (N, q, q);
+  size_t a, b;
+  
+  for (a = 0; a < q; ++a)
+    {
+      priv->comps[a * q + a] = 1.0;
+      for (b = 0; b < q; ++b)
+        priv->table[a * q + b] = (a == b);
+    }
+  
+  return priv;
+}
+
+static void *
+clock_priv_alloc (size_t const N, size_t const q)
+{
+  potts_priv_t * const priv = priv_alloc_common (N, q, 2);
+  size_t a, b;
+  
+  for (a = 0; a < q; ++a)
+    {
+      priv->comps[a * 2] = cos (2 * SPNR_PI * a / q);
+      priv->comps[a * 2 + 1] = sin (2 * SPNR_PI * a / q);
+      for (b = 0; b < q; ++b)
+        priv->table[a * q + b] = cos (2 * SPNR_PI * ((a + q - b) % q) / q);
+    }
+  
+  return priv;
+}
+
+static void
+priv_free (void * const priv)
+{
+  potts_priv_t * const priv_ = (potts_priv_t *) priv;
+  free_err (priv_->spins);
+  free_err (priv_->table);
+  free_err (priv_->comps);
+  free_err (priv_);
+}
+
+static size_t
+spin_size (void *priv)
+{
+  return sizeof (spin_t);
+}
+
+static void
+fill_prop (void const * const priv, void * const prop, size_t const k)
+{
+  potts_priv_t const * const priv_ = (potts_priv_t *) priv;
+  size_t const q = priv_->q;
+  
+  *(spin_t*) prop = (priv_->spins[k] + 1 + spnr_rng_int (q - 1)) % q;
+}
+
+static void
+accept_prop (void * const priv, void const * const prop, size_t const k)
+{
+  potts_priv_t * const priv_ = (potts_priv_t *) priv;
+  priv_->spins[k] = *(spin_t*) prop;
+}
+
+/* energy of state a in the single-site field acting on site k */
+static float
+site_h (potts_priv_t const * const priv, spnr_field_t const * const field,
+        spin_t const a, size_t const k)
+{
+  size_t const n = priv->n;
+  float const * const comps = priv->comps + a * n;
+  float h = 0;
+  size_t j;
+  
+  if (field->uniform)
+    for (j = 0; j < n; ++j)
+      h -= field->uniform[j] * comps[j];
+  if (field->site)
+    for (j = 0; j < n; ++j)
+      h -= field->site[k * n + j] * comps[j];
+  
+  return h - field->aniso * comps[0] * comps[0];
+}
+
+static float
+calc_delta_h_binary (void const * const priv,
+                     spnr_field_t const * const field,
+                     size_t const n_sites,
+                     float const * const J,
+                     size_t const * const sites,
+                     void const * const prop,
+                     size_t const k)
+{
+  potts_priv_t const * const priv_ = (potts_priv_t *) priv;
+  spin_t const * const spins = priv_->spins;
+  spin_t const state = *(spin_t*) prop;
+  size_t const q = priv_->q;
+  float const * const row_new = priv_->table + state * q;
+  float const * const row_old = priv_->table + spins[k] * q;
+  float h = 0;
+  size_t i;
+  
+  for (i = 0; i < n_sites; ++i)
+    h += J[i] * (row_new[spins[sites[i]]] - row_old[spins[sites[i]]]);
+  
+  if (field->uniform || field->site || field->aniso != 0)
+    return -h + site_h (priv_, field, state, k) - site_h (priv_, field, spins[k], k);
+  else
+    return -h;
+}
+
+static float
+calc_part_h_binary (void const * const priv,
+                    spnr_field_t const * const field,
+                    size_t const n_sites,
+                    float const * const J, size_t const * const sites,
+                    size_t const k)
+{
+  potts_priv_t const * const priv_ = (potts_priv_t *) priv;
+  spin_t const * const spins = priv_->spins;
+  float const * const row = priv_->table + spins[k] * priv_->q;
+  float h = 0;
+  size_t i;
+  
+  for (i = 0; i < n_sites; ++i)
+    h += J[i] * row[spins[sites[i]]];
+  
+  return -h + 2 * site_h (priv_, field, spins[k], k);
+}
+
+/* (q rho_max - 1) / (q - 1), with rho_max the largest state density */
+static float
+potts_calc_phi (void const * const priv, size_t const N)
+{
+  potts_priv_t const * const priv_ = (potts_priv_t *) priv;
+  size_t const q = priv_->q;
+  size_t i, max = 0;
+  size_t count[SPNR_POTTS_Q_MAX];
+  
+  memset (count, 0, sizeof (count));
+#pragma omp parallel for reduction (+:count[:SPNR_POTTS_Q_MAX]) \
+  if (N >= SPNR_PAR_MIN)
+  for (i = 0; i < N; ++i)
+    ++count[priv_->spins[i]];
+  
+  for (i = 0; i < q; ++i)
+    if (count[i] > max)
+      max = count[i];
+  
+  return (q * (float) max / N - 1) / (q - 1);
+}
+
+static float
+clock_calc_phi (void const * const priv, size_t const N)
+{
+  potts_priv_t const * const priv_ = (potts_priv_t *) priv;
+  size_t i;
+  double mx = 0, my = 0;
+  
+#pragma omp parallel for reduction (+:mx, my) if (N >= SPNR_PAR_MIN)
+  for (i = 0; i < N; ++i)
+    {
+      mx += priv_->comps[priv_->spins[i] * 2];
+      my += priv_->comps[priv_->spins[i] * 2 + 1];
+    }
+  
+  return sqrt (mx * mx + my * my) / N;
+}
+
+static size_t
+n_comps (void const * const priv)
+{
+  return ((potts_priv_t *) priv)->n;
+}
+
+static void
+get_comps (void const * const priv, float * const comps,
+           size_t const k, size_t const count)
+{
+  potts_priv_t const * const priv_ = (potts_priv_t *) priv;
+  size_t const n = priv_->n;
+  size_t i;
+  
+  for (i = 0; i < count; ++i)
+    memcpy (comps + i * n, priv_->comps + priv_->spins[k + i] * n,
+            n * sizeof (float));
+}
+
+static void
+prop_comps (void const * const priv, void const * const prop,
+            float * const comps)
+{
+  potts_priv_t const * const priv_ = (potts_priv_t *) priv;
+  size_t const n = priv_->n;
+  
+  memcpy (comps, priv_->comps + *(spin_t*) prop * n, n * sizeof (float));
+}
+
+static void
+copy (void * const dst, void const * const src, size_t const N)
+{
+  potts_priv_t * const dst_ = (potts_priv_t *) dst;
+  potts_priv_t const * const src_ = (potts_priv_t *) src;
+  
+  memcpy (dst_->spins, src_->spins, N * sizeof (spin_t));
+}
+
+/* one byte per spin, the state itself */
+static size_t
+pack_size (void const * const priv, size_t const N)
+{
+  return N;
+}
+
+static void
+pack (void const * const priv, unsigned char * const buf, size_t const N)
+{
+  memcpy (buf, ((potts_priv_t *) priv)->spins, N);
+}
+
+static void
+unpack (void * const priv, unsigned char const * const buf, size_t const N)
+{
+  potts_priv_t * const priv_ = (potts_priv_t *) priv;
+  size_t i;
+  
+  for (i = 0; i < N; ++i)
+    {
+      if (buf[i] >= priv_->q)
+        spnr_err (SPNR_ERROR_PARAM_OOB, "state out of bounds in snapshot");
+      priv_->spins[i] = buf[i];
+    }
+}
+
+static const spnr_sys_kind_t potts_kind =
+{
+  "potts",
+  &potts_priv_alloc,
+  &priv_free,
+  &spin_size,
+  &set_up,
+  &set_rand,
+  &fill_prop,
+  &accept_prop,
+  &calc_delta_h_binary,
+  &calc_part_h_binary,
+  &potts_calc_phi,
+  &n_comps,
+  &get_comps,
+  &prop_comps,
+  &copy,
+  &pack_size,
+  &pack,
+  &unpack,
+  NULL
+};
+
+static const spnr_sys_kind_t clock_kind =
+{
+  "clock",
+  &clock_priv_alloc,
+  &priv_free,
+  &spin_size,
+  &set_up,
+  &set_rand,
+  &fill_prop,
+  &accept_prop,
+  &calc_delta_h_binary,
+  &calc_part_h_binary,
+  &clock_calc_phi,
+  &n_comps,
+  &get_comps,
+  &prop_comps,
+  &copy,
+  &pack_size,
+  &pack,
+  &unpack,
+  NULL
+};
+
+const spnr_sys_kind_t *spnr_potts = &potts_kind;
+const spnr_sys_kind_t *spnr_clock = &clock_kind;
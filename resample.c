@@ -0,0 +1,317 @@
+/* resample.c
+ * 
+ * Copyright (C) 2024 L. Bertini
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <math.h>
+
+#include "spinner.h"
+#include "error.h"
+#include "internal.h"
+#include "rng.h"
+
+/* The probes are reduced once to the sums of the moments over each bin
+ * and each series, so that a jackknife sample costs O(n_series) and a
+ * bootstrap one O(n_series n_bins), however long the runs are. */
+
+typedef struct
+{
+  size_t n_series;
+  size_t n_bins;
+  size_t *len;
+  spnr_moments_t *bins;
+  spnr_moments_t *total;
+} binned_t;
+
+static void
+moments_add (spnr_moments_t * const a, spnr_moments_t const * const b,
+             double const c)
+{
+  a->h += c * b->h;
+  a->h2 += c * b->h2;
+  a->m += c * b->m;
+  a->m2 += c * b->m2;
+  a->m4 += c * b->m4;
+}
+
+static void
+bin (binned_t * const b, spnr_data_t const * const * const data,
+     size_t const n_series, size_t const n_bins)
+{
+  size_t s, j, t;
+
+  if (!data || !n_series)
+    spnr_err (SPNR_ERROR_ARG_NULL, "no data series");
+  if (n_bins < 2)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "at least 2 bins are needed");
+
+  b->n_series = n_series;
+  b->n_bins = n_bins;
+  b->len = malloc_err (n_series * sizeof (size_t));
+  b->bins = malloc_err (n_series * n_bins * sizeof (spnr_moments_t));
+  b->total = malloc_err (n_series * sizeof (spnr_moments_t));
+
+  for (s = 0; s < n_series; ++s)
+    {
+      b->len[s] = data[s]->size / n_bins;
+      if (!b->len[s])
+        spnr_err (SPNR_ERROR_PARAM_OOB, "series shorter than the bins");
+    }
+
+#pragma omp parallel for collapse (2) private (t) \
+  if (n_series * data[0]->size >= SPNR_PAR_MIN)
+  for (s = 0; s < n_series; ++s)
+    for (j = 0; j < n_bins; ++j)
+      {
+        spnr_moments_t * const x = b->bins + s * n_bins + j;
+        float const * const h = data[s]->h + j * b->len[s];
+        float const * const phi = data[s]->phi + j * b->len[s];
+        double sh = 0, sh2 = 0, sm = 0, sm2 = 0, sm4 = 0, a;
+
+        for (t = 0; t < b->len[s]; ++t)
+          {
+            a = fabs (phi[t]);
+            sh += h[t];
+            sh2 += (double) h[t] * h[t];
+            sm += a;
+            sm2 += a * a;
+            sm4 += a * a * a * a;
+          }
+        x->h = sh;
+        x->h2 = sh2;
+        x->m = sm;
+        x->m2 = sm2;
+        x->m4 = sm4;
+      }
+
+  for (s = 0; s < n_series; ++s)
+    {
+      b->total[s] = b->bins[s * n_bins];
+      for (j = 1; j < n_bins; ++j)
+        moments_add (b->total + s, b->bins + s * n_bins + j, 1);
+    }
+}
+
+static void
+bin_free (binned_t * const b)
+{
+  free_err (b->len);
+  free_err (b->bins);
+  free_err (b->total);
+}
+
+static void
+eval (double * const theta, spnr_moments_t const * const mom,
+      size_t const n_series, spnr_estimator_t const * const f,
+      size_t const n_est, void const * const ctx)
+{
+  size_t e;
+
+  for (e = 0; e < n_est; ++e)
+    theta[e] = f[e] (mom, n_series, ctx);
+}
+
+/* estimates of the full data */
+static void
+eval_full (double * const theta, binned_t const * const b,
+           spnr_moments_t * const mom, spnr_estimator_t const * const f,
+           size_t const n_est, void const * const ctx)
+{
+  size_t s;
+
+  for (s = 0; s < b->n_series; ++s)
+    {
+      mom[s].h = mom[s].h2 = mom[s].m = mom[s].m2 = mom[s].m4 = 0;
+      moments_add (mom + s, b->total + s, 1.0 / (b->n_bins * b->len[s]));
+    }
+  eval (theta, mom, b->n_series, f, n_est, ctx);
+}
+
+void
+spnr_jackknife (double * const est, double * const err,
+                spnr_data_t const * const * const data,
+                size_t const n_series, size_t const n_bins,
+                spnr_estimator_t const * const f, size_t const n_est,
+                void const * const ctx)
+{
+  binned_t b;
+  spnr_moments_t *mom;
+  double *theta, mean, var;
+  size_t j, s, e;
+
+  bin (&b, data, n_series, n_bins);
+  mom = malloc_err ((n_bins + 1) * n_series * sizeof (spnr_moments_t));
+  theta = malloc_err ((n_bins + 1) * n_est * sizeof (double));
+
+  eval_full (theta + n_bins * n_est, &b, mom + n_bins * n_series, f, n_est,
+             ctx);
+
+#pragma omp parallel for private (s) if (n_bins * n_series >= SPNR_PAR_MIN)
+  for (j = 0; j < n_bins; ++j)
+    {
+      spnr_moments_t * const m = mom + j * n_series;
+
+      for (s = 0; s < n_series; ++s)
+        {
+          double const c = 1.0 / ((n_bins - 1) * b.len[s]);
+
+          m[s].h = m[s].h2 = m[s].m = m[s].m2 = m[s].m4 = 0;
+          moments_add (m + s, b.total + s, c);
+          moments_add (m + s, b.bins + s * n_bins + j, -c);
+        }
+      eval (theta + j * n_est, m, n_series, f, n_est, ctx);
+    }
+
+  for (e = 0; e < n_est; ++e)
+    {
+      mean = var = 0;
+      for (j = 0; j < n_bins; ++j)
+        mean += theta[j * n_est + e];
+      mean /= n_bins;
+      for (j = 0; j < n_bins; ++j)
+        var += (theta[j * n_est + e] - mean) * (theta[j * n_est + e] - mean);
+
+      est[e] = n_bins * theta[n_bins * n_est + e] - (n_bins - 1) * mean;
+      err[e] = sqrt (var * (n_bins - 1) / n_bins);
+    }
+
+  free_err (theta);
+  free_err (mom);
+  bin_free (&b);
+}
+
+void
+spnr_bootstrap (double * const est, double * const err,
+                spnr_data_t const * const * const data,
+                size_t const n_series, size_t const n_bins,
+                spnr_estimator_t const * const f, size_t const n_est,
+                void const * const ctx, size_t const n_boot,
+                unsigned long const seed)
+{
+  binned_t b;
+  spnr_moments_t *mom;
+  double *theta, mean, var;
+  size_t r, s, i, e;
+
+  if (n_boot < 2)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "at least 2 bootstrap samples are needed");
+
+  bin (&b, data, n_series, n_bins);
+  mom = malloc_err ((n_boot + 1) * n_series * sizeof (spnr_moments_t));
+  theta = malloc_err ((n_boot + 1) * n_est * sizeof (double));
+
+  eval_full (theta + n_boot * n_est, &b, mom + n_boot * n_series, f, n_est,
+             ctx);
+
+  /* each sample draws from a stream of its own, so results do not
+   * depend on the number of threads */
+#pragma omp parallel for private (s, i) schedule (dynamic) \
+  if (n_boot * n_series * n_bins >= SPNR_PAR_MIN)
+  for (r = 0; r < n_boot; ++r)
+    {
+      spnr_moments_t * const m = mom + r * n_series;
+
+      spnr_rng_seed (spnr_rng_hash (seed, r));
+      for (s = 0; s < n_series; ++s)
+        {
+          double const c = 1.0 / (n_bins * b.len[s]);
+
+          m[s].h = m[s].h2 = m[s].m = m[s].m2 = m[s].m4 = 0;
+          for (i = 0; i < n_bins; ++i)
+            moments_add (m + s, b.bins + s * n_bins + spnr_rng_int (n_bins),
+                         c);
+        }
+      eval (theta + r * n_est, m, n_series, f, n_est, ctx);
+    }
+
+  /* the calling thread continues from a stream of its own */
+  spnr_rng_seed (spnr_rng_hash (~seed, 0));
+
+  for (e = 0; e < n_est; ++e)
+    {
+      mean = var = 0;
+      for (r = 0; r < n_boot; ++r)
+        mean += theta[r * n_est + e];
+      mean /= n_boot;
+      for (r = 0; r < n_boot; ++r)
+        var += (theta[r * n_est + e] - mean) * (theta[r * n_est + e] - mean);
+
+      est[e] = theta[n_boot * n_est + e];
+      err[e] = sqrt (var / (n_boot - 1));
+    }
+
+  free_err (theta);
+  free_err (mom);
+  bin_free (&b);
+}
+
+/* Estimators of the first series, as in spnr_scan_summary */
+
+static spnr_est_args_t const *
+est_args (void const * const ctx)
+{
+  if (!ctx)
+    spnr_err (SPNR_ERROR_ARG_NULL, "estimator needs beta and N");
+  return (spnr_est_args_t const *) ctx;
+}
+
+double
+spnr_est_e (spnr_moments_t const * const mom, size_t const n_series,
+            void const * const ctx)
+{
+  (void) n_series;
+  (void) ctx;
+  return mom->h;
+}
+
+double
+spnr_est_m (spnr_moments_t const * const mom, size_t const n_series,
+            void const * const ctx)
+{
+  (void) n_series;
+  (void) ctx;
+  return mom->m;
+}
+
+double
+spnr_est_c (spnr_moments_t const * const mom, size_t const n_series,
+            void const * const ctx)
+{
+  spnr_est_args_t const * const args = est_args (ctx);
+
+  (void) n_series;
+  return args->beta * args->beta * args->N * (mom->h2 - mom->h * mom->h);
+}
+
+double
+spnr_est_chi (spnr_moments_t const * const mom, size_t const n_series,
+              void const * const ctx)
+{
+  spnr_est_args_t const * const args = est_args (ctx);
+
+  (void) n_series;
+  return args->beta * args->N * (mom->m2 - mom->m * mom->m);
+}
+
+double
+spnr_est_binder (spnr_moments_t const * const mom, size_t const n_series,
+                 void const * const ctx)
+{
+  (void) n_series;
+  (void) ctx;
+  return 1 - mom->m4 / (3 * mom->m2 * mom->m2);
+}
@@ -0,0 +1,192 @@
+/* reweight.c
+ * 
+ * Copyright (C) 2024 L. Bertini
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <math.h>
+
+#include "spinner.h"
+#include "error.h"
+
+#define SPNR_WHAM_ITER_MAX 10000
+#define SPNR_WHAM_TOL 1e-10
+
+/* Ferrenberg-Swendsen reweighting of the energy and magnetization
+ * series of one or more runs at different temperatures. The runs are
+ * combined with the multiple histogram (WHAM) equations
+ *   D_t = sum_m n_m exp (-beta_m E_t - f_m),
+ *   f_k = ln sum_t exp (-beta_k E_t) / D_t,
+ * solved by fixed point iteration; with a single run this reduces to
+ * single histogram reweighting. All sums are done as log-sum-exp in
+ * double precision. */
+
+typedef struct
+{
+  size_t n_runs;
+  size_t n_samples;
+  double *beta;
+  double *f;
+  double *ln_n;
+  double *e;
+  double *ln_d;
+} wham_t;
+
+static void
+wham_calc_ln_d (wham_t * const w)
+{
+  size_t t, m;
+  double max, sum, x;
+  
+#pragma omp parallel for private (m, max, sum, x)
+  for (t = 0; t < w->n_samples; ++t)
+    {
+      max = -INFINITY;
+      for (m = 0; m < w->n_runs; ++m)
+        {
+          x = w->ln_n[m] - w->beta[m] * w->e[t] - w->f[m];
+          if (x > max)
+            max = x;
+        }
+      sum = 0;
+      for (m = 0; m < w->n_runs; ++m)
+        sum += exp (w->ln_n[m] - w->beta[m] * w->e[t] - w->f[m] - max);
+      w->ln_d[t] = max + log (sum);
+    }
+}
+
+/* ln of the (unnormalized) partition function at beta */
+static double
+wham_ln_z (wham_t const * const w, double const beta)
+{
+  size_t t;
+  double max = -INFINITY, sum = 0, x;
+  
+  for (t = 0; t < w->n_samples; ++t)
+    {
+      x = -beta * w->e[t] - w->ln_d[t];
+      if (x > max)
+        max = x;
+    }
+  for (t = 0; t < w->n_samples; ++t)
+    sum += exp (-beta * w->e[t] - w->ln_d[t] - max);
+  
+  return max + log (sum);
+}
+
+static void
+wham_solve (wham_t * const w)
+{
+  size_t it, k;
+  double diff, f_new, f0;
+  
+  for (k = 0; k < w->n_runs; ++k)
+    w->f[k] = 0;
+  
+  for (it = 0; it < SPNR_WHAM_ITER_MAX; ++it)
+    {
+      wham_calc_ln_d (w);
+      f0 = wham_ln_z (w, w->beta[0]);
+      diff = 0;
+      for (k = 0; k < w->n_runs; ++k)
+        {
+          f_new = wham_ln_z (w, w->beta[k]) - f0;
+          if (fabs (f_new - w->f[k]) > diff)
+            diff = fabs (f_new - w->f[k]);
+          w->f[k] = f_new;
+        }
+      if (diff < SPNR_WHAM_TOL)
+        break;
+    }
+  
+  if (it == SPNR_WHAM_ITER_MAX)
+    spnr_warn (SPNR_FAILURE, "histogram reweighting did not converge");
+  wham_calc_ln_d (w);
+}
+
+void
+spnr_reweight_multi (spnr_scan_t * const out,
+                     spnr_data_t const * const * const data,
+                     float const * const temps, size_t const n_runs,
+                     size_t const N)
+{
+  size_t m, t, i, s;
+  wham_t w;
+  
+  w.n_runs = n_runs;
+  w.n_samples = 0;
+  for (m = 0; m < n_runs; ++m)
+    w.n_samples += data[m]->size;
+  
+  w.beta = malloc_err (n_runs * sizeof (double));
+  w.f = malloc_err (n_runs * sizeof (double));
+  w.ln_n = malloc_err (n_runs * sizeof (double));
+  w.e = malloc_err (w.n_samples * sizeof (double));
+  w.ln_d = malloc_err (w.n_samples * sizeof (double));
+  
+  for (m = 0, s = 0; m < n_runs; ++m)
+    {
+      w.beta[m] = 1.0 / temps[m];
+      w.ln_n[m] = log (data[m]->size);
+      for (t = 0; t < data[m]->size; ++t)
+        w.e[s++] = (double) N * data[m]->h[t];
+    }
+  
+  wham_solve (&w);
+  
+#pragma omp parallel for private (m, t, s)
+  for (i = 0; i < out->size; ++i)
+    {
+      double const beta = 1.0 / out->x[i];
+      double const ln_z = wham_ln_z (&w, beta);
+      double p, h, a, sum_h = 0, sum_h2 = 0, sum_m = 0, sum_m2 = 0, sum_m4 = 0;
+      
+      for (m = 0, s = 0; m < n_runs; ++m)
+        for (t = 0; t < data[m]->size; ++t, ++s)
+          {
+            p = exp (-beta * w.e[s] - w.ln_d[s] - ln_z);
+            h = data[m]->h[t];
+            a = fabs (data[m]->phi[t]);
+            sum_h += p * h;
+            sum_h2 += p * h * h;
+            sum_m += p * a;
+            sum_m2 += p * a * a;
+            sum_m4 += p * a * a * a * a;
+          }
+      
+      out->h_mean[i] = sum_h;
+      out->h_var[i] = sum_h2 - sum_h * sum_h;
+      out->phi_mean[i] = sum_m;
+      out->phi_var[i] = sum_m2 - sum_m * sum_m;
+      out->c[i] = beta * beta * N * out->h_var[i];
+      out->chi[i] = beta * N * out->phi_var[i];
+      out->binder[i] = 1 - sum_m4 / (3 * sum_m2 * sum_m2);
+      out->n_equil[i] = 0;
+    }
+  
+  free_err (w.beta);
+  free_err (w.f);
+  free_err (w.ln_n);
+  free_err (w.e);
+  free_err (w.ln_d);
+}
+
+void
+spnr_reweight (spnr_scan_t * const out, spnr_data_t const * const data,
+               float const temp, size_t const N)
+{
+  spnr_reweight_multi (out, &data, &temp, 1, N);
+}
@@ -0,0 +1,237 @@
+/* rng.c
+ * 
+ * Copyright (C) 2024 L. Bertini
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+
+#include "spinner.h"
+#include "rng.h"
+#include "internal.h"
+
+#define SPNR_RNG_GOLDEN 0x9e3779b97f4a7c15ULL
+#define SPNR_RNG_BATCH 64
+
+static _Thread_local uint64_t state = SPNR_RNG_GOLDEN;
+
+/* splitmix64 finalizer */
+static uint64_t
+mix (uint64_t z)
+{
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+uint64_t
+spnr_rng_hash (uint64_t const seed, uint64_t const ctr)
+{
+  return mix (mix (seed + SPNR_RNG_GOLDEN) + ctr * SPNR_RNG_GOLDEN);
+}
+
+/* uniform in [0, 1) with 53 random bits */
+double
+spnr_rng_hash_unif (uint64_t const seed, uint64_t const ctr)
+{
+  return (spnr_rng_hash (seed, ctr) >> 11) * 0x1.0p-53;
+}
+
+void
+spnr_rng_seed (unsigned long const seed)
+{
+  state = spnr_rng_hash (seed, 0);
+}
+
+/* splitmix64 */
+uint64_t
+spnr_rng_next (void)
+{
+  state += SPNR_RNG_GOLDEN;
+  return mix (state);
+}
+
+/* uniform in [0, 1) */
+float
+spnr_rng_unif (void)
+{
+  return (spnr_rng_next () >> 40) * 0x1.0p-24f;
+}
+
+/* uniform in {0, ..., n - 1} */
+size_t
+spnr_rng_int (size_t const n)
+{
+  return spnr_rng_next () % n;
+}
+
+/* Batched generators
+ *
+ * The draws of a block are computed from the counter of the stream,
+ * and the transforms are single precision polynomials (from Cephes)
+ * in loops without calls or branches, which the compiler vectorizes.
+ * The blocks consume the stream like the same number of calls to
+ * spnr_rng_next. */
+
+static void
+draw (uint64_t * const x, size_t const m)
+{
+  uint64_t const s = state;
+  size_t i;
+
+#pragma omp simd
+  for (i = 0; i < m; ++i)
+    x[i] = mix (s + (i + 1) * SPNR_RNG_GOLDEN);
+  state = s + m * SPNR_RNG_GOLDEN;
+}
+
+static inline float
+as_float (uint32_t const i)
+{
+  float f;
+  memcpy (&f, &i, sizeof (f));
+  return f;
+}
+
+static inline uint32_t
+as_uint (float const f)
+{
+  uint32_t i;
+  memcpy (&i, &f, sizeof (i));
+  return i;
+}
+
+/* natural log of a positive normal x, the mantissa is taken in
+ * [sqrt (1/2), sqrt (2)) */
+static inline float
+log_poly (float const x)
+{
+  uint32_t const bits = as_uint (x);
+  int32_t const big = (bits & 0x7fffff) > 0x3504f3;
+  float const e = (float) ((int32_t) (bits >> 23) - 127 + big);
+  float const f = as_float ((bits & 0x7fffff) | (0x3f800000 - (big << 23)))
+    - 1;
+  float const z = f * f;
+  float y;
+
+  y = 7.0376836292e-2f;
+  y = y * f - 1.1514610310e-1f;
+  y = y * f + 1.1676998740e-1f;
+  y = y * f - 1.2420140846e-1f;
+  y = y * f + 1.4249322787e-1f;
+  y = y * f - 1.6668057665e-1f;
+  y = y * f + 2.0000714765e-1f;
+  y = y * f - 2.4999993993e-1f;
+  y = y * f + 3.3333331174e-1f;
+  y = y * f * z - 2.12194440e-4f * e - 0.5f * z;
+
+  return f + y + 0.693359375f * e;
+}
+
+/* square root of x >= 0, from the reciprocal square root estimate and
+ * three Newton steps; libm sqrtf does not vectorize with errno */
+static inline float
+sqrt_newton (float const x)
+{
+  float r = as_float (0x5f3759df - (as_uint (x) >> 1));
+
+  r = r * (1.5f - 0.5f * x * r * r);
+  r = r * (1.5f - 0.5f * x * r * r);
+  r = r * (1.5f - 0.5f * x * r * r);
+  return x * r;
+}
+
+/* sine and cosine of 2 pi v for v in [0, 1), reduced to octants */
+static inline void
+sincos_2pi (float const v, float * const s, float * const c)
+{
+  int32_t const q = (int32_t) (4 * v + 0.5f);
+  float const a = (v - 0.25f * q) * (2 * (float) SPNR_PI);
+  float const z = a * a;
+  float const s0 = a + a * z * ((-1.9515295891e-4f * z + 8.3321608736e-3f) * z
+                                - 1.6666654611e-1f);
+  float const c0 = 1 - 0.5f * z
+    + z * z * ((2.443315711809948e-5f * z - 1.388731625493765e-3f) * z
+               + 4.166664568298827e-2f);
+  float const ss = (q & 1) ? c0 : s0;
+  float const cc = (q & 1) ? s0 : c0;
+
+  *s = (q & 2) ? -ss : ss;
+  *c = ((q + 1) & 2) ? -cc : cc;
+}
+
+/* uniform in [0, 1), the same as n calls to spnr_rng_unif */
+void
+spnr_rng_fill_unif (float * const u, size_t const n)
+{
+  uint64_t x[SPNR_RNG_BATCH];
+  size_t b, i, m;
+
+  for (b = 0; b < n; b += m)
+    {
+      m = n - b < SPNR_RNG_BATCH ? n - b : SPNR_RNG_BATCH;
+      draw (x, m);
+#pragma omp simd
+      for (i = 0; i < m; ++i)
+        u[b + i] = (int32_t) (x[i] >> 40) * 0x1.0p-24f;
+    }
+}
+
+/* exponential with unit mean, - log (1 - u) */
+void
+spnr_rng_fill_exp (float * const e, size_t const n)
+{
+  uint64_t x[SPNR_RNG_BATCH];
+  size_t b, i, m;
+
+  for (b = 0; b < n; b += m)
+    {
+      m = n - b < SPNR_RNG_BATCH ? n - b : SPNR_RNG_BATCH;
+      draw (x, m);
+#pragma omp simd
+      for (i = 0; i < m; ++i)
+        e[b + i] = - log_poly (1 - (int32_t) (x[i] >> 40) * 0x1.0p-24f);
+    }
+}
+
+/* standard normal, Box-Muller with the two uniforms of a pair taken
+ * from the halves of one draw */
+void
+spnr_rng_fill_gauss (float * const g, size_t const n)
+{
+  uint64_t x[SPNR_RNG_BATCH];
+  float buf[2 * SPNR_RNG_BATCH];
+  size_t b, i, m;
+
+  for (b = 0; b < n; b += 2 * m)
+    {
+      m = (n - b + 1) / 2 < SPNR_RNG_BATCH ? (n - b + 1) / 2 : SPNR_RNG_BATCH;
+      draw (x, m);
+#pragma omp simd
+      for (i = 0; i < m; ++i)
+        {
+          float const u = 1 - (int32_t) (x[i] >> 40) * 0x1.0p-24f;
+          float const v = (int32_t) (x[i] & 0xffffff) * 0x1.0p-24f;
+          float const r = sqrt_newton (-2 * log_poly (u));
+          float s, c;
+
+          sincos_2pi (v, &s, &c);
+          buf[2 * i] = r * c;
+          buf[2 * i + 1] = r * s;
+        }
+      memcpy (g + b, buf, (n - b < 2 * m ? n - b : 2 * m) * sizeof (float));
+    }
+}
@@ -0,0 +1,61 @@
+/* rng.h
+ * 
+ * Copyright (C) 2024 L. Bertini
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef RNG_H
+#define RNG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#undef BEGIN_C_DECLS
+#undef END_C_DECLS
+#ifdef __cplusplus
+# define BEGIN_C_DECLS extern "C" {
+# define END_C_DECLS }
+#else
+# define BEGIN_C_DECLS /* empty */
+# define END_C_DECLS /* empty */
+#endif
+
+BEGIN_C_DECLS
+
+/* Counter based generator: the output is a pure function of the seed
+ * and of the counter, so that streams can be evaluated in any order
+ * and from any thread */
+
+extern uint64_t spnr_rng_hash (uint64_t seed, uint64_t ctr);
+extern double spnr_rng_hash_unif (uint64_t seed, uint64_t ctr);
+
+/* Sequential generator with one stream per thread, seeded with
+ * spnr_rng_seed; threads spawned by the library seed their own stream
+ * explicitly, so results do not depend on the scheduling */
+
+extern uint64_t spnr_rng_next (void);
+extern float spnr_rng_unif (void);
+extern size_t spnr_rng_int (size_t n);
+
+/* Batched draws from the stream of the calling thread, vectorized */
+
+extern void spnr_rng_fill_unif (float *u, size_t n);
+extern void spnr_rng_fill_exp (float *e, size_t n);
+extern void spnr_rng_fill_gauss (float *g, size_t n);
+
+END_C_DECLS
+
+#endif
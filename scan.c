@@ -0,0 +1,232 @@
+/* scan.c
+ * 
+ * Copyright (C) 2024 L. Bertini
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+#include <math.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "spinner.h"
+#include "error.h"
+#include "rng.h"
+
+#define SPNR_SCAN_BLOCKS_MAX 64
+
+spnr_scan_t *
+spnr_scan_alloc (size_t const size)
+{
+  spnr_scan_t * const scan = malloc_err (sizeof (spnr_scan_t));
+  
+  scan->size = size;
+  scan->x = malloc_err (size * sizeof (float));
+  scan->h_mean = malloc_err (size * sizeof (float));
+  scan->h_var = malloc_err (size * sizeof (float));
+  scan->phi_mean = malloc_err (size * sizeof (float));
+  scan->phi_var = malloc_err (size * sizeof (float));
+  scan->c = malloc_err (size * sizeof (float));
+  scan->chi = malloc_err (size * sizeof (float));
+  scan->binder = malloc_err (size * sizeof (float));
+  scan->n_equil = malloc_err (size * sizeof (size_t));
+  memset (scan->n_equil, 0, size * sizeof (size_t));
+  
+  return scan;
+}
+
+void
+spnr_scan_free (spnr_scan_t * const scan)
+{
+  free_err (scan->x);
+  free_err (scan->h_mean);
+  free_err (scan->h_var);
+  free_err (scan->phi_mean);
+  free_err (scan->phi_var);
+  free_err (scan->c);
+  free_err (scan->chi);
+  free_err (scan->binder);
+  free_err (scan->n_equil);
+  free_err (scan);
+}
+
+void
+spnr_scan_write (spnr_scan_t const * const scan, char const * const fname)
+{
+  FILE *f;
+  size_t i;
+  
+  f = fopen (fname, "w");
+  if (!f)
+    spnr_err (SPNR_FAILURE, "cannot open scan output file");
+  
+  fprintf (f, "# x h_mean h_var phi_mean phi_var c chi binder n_equil\n");
+  for (i = 0; i < scan->size; ++i)
+    fprintf (f, "%f %+f %f %+f %f %f %f %f %lu\n", scan->x[i],
+             scan->h_mean[i], scan->h_var[i], scan->phi_mean[i],
+             scan->phi_var[i], scan->c[i], scan->chi[i], scan->binder[i],
+             (unsigned long) scan->n_equil[i]);
+  
+  fclose (f);
+}
+
+/* fills row i of the table from the probes in data */
+void
+spnr_scan_summary (spnr_scan_t * const scan, size_t const i,
+                   spnr_data_t const * const data,
+                   float const beta, size_t const N)
+{
+  size_t t;
+  size_t const size = data->size;
+  double h = 0, h2 = 0, m = 0, m2 = 0, m4 = 0, a;
+  
+  for (t = 0; t < size; ++t)
+    {
+      a = fabs (data->phi[t]);
+      h += data->h[t];
+      h2 += (double) data->h[t] * data->h[t];
+      m += a;
+      m2 += a * a;
+      m4 += a * a * a * a;
+    }
+  h /= size;
+  h2 /= size;
+  m /= size;
+  m2 /= size;
+  m4 /= size;
+  
+  scan->h_mean[i] = h;
+  scan->h_var[i] = h2 - h * h;
+  scan->phi_mean[i] = m;
+  scan->phi_var[i] = m2 - m * m;
+  scan->c[i] = beta * beta * N * (h2 - h * h);
+  scan->chi[i] = beta * N * (m2 - m * m);
+  scan->binder[i] = 1 - m4 / (3 * m2 * m2);
+}
+
+static void
+block_stats (spnr_data_t const * const block, double * const mean,
+             double * const var)
+{
+  size_t t;
+  double s = 0, s2 = 0;
+  
+  for (t = 0; t < block->size; ++t)
+    {
+      s += block->h[t];
+      s2 += (double) block->h[t] * block->h[t];
+    }
+  *mean = s / block->size;
+  *var = s2 / block->size - *mean * *mean;
+}
+
+/* runs blocks of probes until the mean energy of two consecutive
+ * blocks agrees within three standard errors; returns the number of
+ * steps spent */
+static size_t
+equilibrate (spnr_data_t * const block, spnr_sys_t * const sys,
+             spnr_step_t const * const step, float const temp,
+             size_t const n_steps_before_probe)
+{
+  size_t b;
+  size_t const n = block->size;
+  double mean, var, prev_mean, prev_var;
+  
+  spnr_data_run_and_probe (block, sys, step, temp, n_steps_before_probe);
+  block_stats (block, &prev_mean, &prev_var);
+  
+  for (b = 1; b < SPNR_SCAN_BLOCKS_MAX; ++b)
+    {
+      spnr_data_run_and_probe (block, sys, step, temp, n_steps_before_probe);
+      block_stats (block, &mean, &var);
+      if (fabs (mean - prev_mean) <= 3 * sqrt ((var + prev_var) / n))
+        {
+          ++b;
+          break;
+        }
+      prev_mean = mean;
+      prev_var = var;
+    }
+  
+  return b * (n - 1) * n_steps_before_probe;
+}
+
+/* The grid is split in contiguous chunks, one per thread; each point
+ * of a chunk starts from the configuration reached at the previous
+ * one, so grids should be ordered from the disordered side. Every
+ * point has its own random stream derived from seed. */
+void
+spnr_scan_run (spnr_scan_t * const scan, spnr_sys_t const * const sys,
+               spnr_step_kind_t const * const step_kind, int const mode,
+               float const temp, size_t const n_probes,
+               size_t const n_steps_before_probe, unsigned long const seed)
+{
+  size_t c, n_chunks = 1;
+  size_t const size = scan->size, N = sys->graph->N;
+  size_t const block_size = (n_probes / 4 > 2) ? n_probes / 4 : 2;
+  
+  if (size == 0)
+    return;
+  
+#ifdef _OPENMP
+  n_chunks = omp_get_max_threads ();
+  if (n_chunks > size)
+    n_chunks = size;
+#endif
+  
+#pragma omp parallel for schedule(dynamic, 1)
+  for (c = 0; c < n_chunks; ++c)
+    {
+      size_t i;
+      size_t const first = c * size / n_chunks;
+      size_t const last = (c + 1) * size / n_chunks;
+      spnr_sys_t * const local = spnr_sys_clone (sys);
+      spnr_step_t * const step = spnr_step_alloc (step_kind,
+                                                  spnr_sys_spin_size (local));
+      spnr_data_t * const data = spnr_data_alloc (n_probes);
+      spnr_data_t * const block = spnr_data_alloc (block_size);
+      size_t const n = spnr_sys_n_comps (local);
+      float * const field = malloc_err (n * sizeof (float));
+      float t;
+      
+      memset (field, 0, n * sizeof (float));
+      for (i = first; i < last; ++i)
+        {
+          spnr_rng_seed (spnr_rng_hash (seed, i));
+          
+          if (mode == SPNR_SCAN_FIELD)
+            {
+              t = temp;
+              field[0] = scan->x[i];
+              spnr_sys_set_field (local, field);
+            }
+          else
+            t = scan->x[i];
+          
+          scan->n_equil[i] = equilibrate (block, local, step, t,
+                                          n_steps_before_probe);
+          spnr_data_run_and_probe (data, local, step, t, n_steps_before_probe);
+          spnr_scan_summary (scan, i, data, 1.0 / t, N);
+        }
+      
+      free_err (field);
+      spnr_data_free (block);
+      spnr_data_free (data);
+      spnr_step_free (step);
+      spnr_sys_free (local);
+    }
+}
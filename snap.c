@@ -0,0 +1,519 @@
+/* snap.c
+ * 
+ * Copyright (C) 2024 L. Bertini
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#include "spinner.h"
+#include "error.h"
+#include "internal.h"
+
+#define SPNR_SNAP_MAGIC "SPNRSNP1"
+#define SPNR_SNAP_INDEX_MAGIC "SPNRIDX1"
+#define SPNR_SNAP_KEYFRAME 64
+#define SPNR_SNAP_BUFS 4
+
+/* File layout: header, frames back to back, index (one entry per
+ * frame) and trailer. Like saved graphs, the integers use the native
+ * layout. */
+
+typedef union
+{
+  struct
+  {
+    char magic[8];
+    char kind[SPNR_KIND_NAME_MAX];
+    uint64_t N;
+    uint64_t param;
+    uint64_t frame_size;
+    uint64_t flags;
+    uint64_t keyframe;
+  } h;
+  char pad[128];
+} snap_hdr_t;
+
+typedef struct
+{
+  uint64_t offset;
+  uint64_t len;
+  uint64_t flags; /* encodings actually applied to the frame */
+} snap_entry_t;
+
+typedef struct
+{
+  uint64_t n_frames;
+  uint64_t index;
+  char magic[8];
+} snap_trailer_t;
+
+/* Run length encoding: a control byte c < 128 is followed by c + 1
+ * literal bytes, c >= 128 by one byte repeated c - 125 times. Returns
+ * the encoded length, at most size + size / 128 + 1. */
+static size_t
+rle_encode (unsigned char * const dst, unsigned char const * const src,
+            size_t const size)
+{
+  size_t i = 0, o = 0, run, lit = 0;
+
+  while (i < size)
+    {
+      for (run = 1; i + run < size && run < 130 && src[i + run] == src[i];
+           ++run);
+
+      if (run >= 3)
+        {
+          dst[o++] = run + 125;
+          dst[o++] = src[i];
+          i += run;
+          lit = 0;
+          continue;
+        }
+
+      /* extends the pending literal block, opening a new one if needed */
+      if (!lit || dst[lit - 1] == 127)
+        {
+          dst[o++] = (unsigned char) -1;
+          lit = o;
+        }
+      ++dst[lit - 1];
+      dst[o++] = src[i++];
+    }
+
+  return o;
+}
+
+static void
+rle_decode (unsigned char * const dst, size_t const size,
+            unsigned char const * const src, size_t const len)
+{
+  size_t i = 0, o = 0, n;
+
+  while (i < len)
+    {
+      if (src[i] < 128)
+        {
+          n = src[i] + 1;
+          if (i + 1 + n > len || o + n > size)
+            break;
+          memcpy (dst + o, src + i + 1, n);
+          i += n + 1;
+        }
+      else
+        {
+          n = src[i] - 125;
+          if (i + 1 >= len || o + n > size)
+            break;
+          memset (dst + o, src[i + 1], n);
+          i += 2;
+        }
+      o += n;
+    }
+
+  if (i != len || o != size)
+    spnr_err (SPNR_FAILURE, "corrupted snapshot frame");
+}
+
+static void
+xor_frame (unsigned char * const dst, unsigned char const * const src,
+           size_t const size)
+{
+  size_t i;
+
+  for (i = 0; i < size; ++i)
+    dst[i] ^= src[i];
+}
+
+/* Writer
+ *
+ * Packed frames go through a ring of SPNR_SNAP_BUFS slots, filled by
+ * spnr_snap_writer_push and drained by the encoding thread, which owns
+ * everything below the ring (previous frame, scratch, index). */
+
+struct spnr_snap_writer_struct
+{
+  FILE *f;
+  spnr_sys_kind_t const *kind;
+  size_t N;
+  size_t param;
+  size_t frame_size;
+  int flags;
+  size_t keyframe;
+
+  unsigned char *ring[SPNR_SNAP_BUFS];
+#ifdef HAVE_PTHREAD_H
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+#endif
+  size_t head;
+  size_t tail;
+  size_t count;
+  int done;
+
+  unsigned char *prev;
+  unsigned char *enc;
+  snap_entry_t *index;
+  size_t n_frames;
+  size_t index_size;
+  uint64_t offset;
+};
+
+static void
+writer_encode (spnr_snap_writer_t * const w, unsigned char * const frame)
+{
+  size_t const size = w->frame_size;
+  snap_entry_t e;
+  unsigned char const *out = frame;
+  size_t len = size;
+  snap_entry_t *index;
+
+  e.flags = 0;
+  if (w->flags & SPNR_SNAP_DELTA)
+    {
+      /* keep the plain frame for the next delta */
+      if (w->n_frames % w->keyframe)
+        {
+          xor_frame (w->prev, frame, size);
+          out = w->prev;
+          e.flags |= SPNR_SNAP_DELTA;
+        }
+      else
+        memcpy (w->prev, frame, size);
+    }
+
+  if (w->flags & SPNR_SNAP_RLE)
+    {
+      len = rle_encode (w->enc, out, size);
+      if (len < size)
+        {
+          out = w->enc;
+          e.flags |= SPNR_SNAP_RLE;
+        }
+      else
+        len = size;
+    }
+
+  if (fwrite (out, 1, len, w->f) != len)
+    spnr_err (SPNR_FAILURE, "cannot write snapshot file");
+
+  if (e.flags & SPNR_SNAP_DELTA)
+    memcpy (w->prev, frame, size);
+
+  if (w->n_frames == w->index_size)
+    {
+      w->index_size = w->index_size ? 2 * w->index_size : 1024;
+      index = malloc_err (w->index_size * sizeof (snap_entry_t));
+      memcpy (index, w->index, w->n_frames * sizeof (snap_entry_t));
+      free_err (w->index);
+      w->index = index;
+    }
+  e.offset = w->offset;
+  e.len = len;
+  w->index[w->n_frames++] = e;
+  w->offset += len;
+}
+
+#ifdef HAVE_PTHREAD_H
+
+static void *
+writer_thread (void * const arg)
+{
+  spnr_snap_writer_t * const w = arg;
+  size_t slot;
+
+  for (;;)
+    {
+      pthread_mutex_lock (&w->lock);
+      while (!w->count && !w->done)
+        pthread_cond_wait (&w->not_empty, &w->lock);
+      if (!w->count)
+        {
+          pthread_mutex_unlock (&w->lock);
+          return NULL;
+        }
+      slot = w->tail;
+      pthread_mutex_unlock (&w->lock);
+
+      writer_encode (w, w->ring[slot]);
+
+      pthread_mutex_lock (&w->lock);
+      w->tail = (w->tail + 1) % SPNR_SNAP_BUFS;
+      --w->count;
+      pthread_cond_signal (&w->not_full);
+      pthread_mutex_unlock (&w->lock);
+    }
+}
+
+#endif
+
+spnr_snap_writer_t *
+spnr_snap_writer_alloc (char const * const fname,
+                        spnr_sys_t const * const sys,
+                        int const flags, size_t const keyframe)
+{
+  spnr_snap_writer_t * const w = malloc_err (sizeof (spnr_snap_writer_t));
+  size_t const N = sys->graph->N;
+  snap_hdr_t hdr;
+  size_t i;
+
+  if (!sys->kind->pack)
+    spnr_err (SPNR_ERROR_FUNC_NULL, "system kind cannot be packed");
+
+  w->f = fopen (fname, "wb");
+  if (!w->f)
+    spnr_err (SPNR_FAILURE, "cannot open snapshot file");
+
+  w->kind = sys->kind;
+  w->N = N;
+  w->param = sys->param;
+  w->frame_size = sys->kind->pack_size (sys->priv, N);
+  w->flags = flags;
+  w->keyframe = keyframe ? keyframe : SPNR_SNAP_KEYFRAME;
+
+  for (i = 0; i < SPNR_SNAP_BUFS; ++i)
+    w->ring[i] = malloc_err (w->frame_size);
+  w->head = w->tail = w->count = 0;
+  w->done = SPNR_FALSE;
+
+  w->prev = malloc_err (w->frame_size);
+  w->enc = malloc_err (w->frame_size + w->frame_size / 128 + 1);
+  w->index = NULL;
+  w->n_frames = 0;
+  w->index_size = 0;
+
+  memset (&hdr, 0, sizeof (hdr));
+  memcpy (hdr.h.magic, SPNR_SNAP_MAGIC, sizeof (hdr.h.magic));
+  strncpy (hdr.h.kind, sys->kind->name, SPNR_KIND_NAME_MAX - 1);
+  hdr.h.N = N;
+  hdr.h.param = sys->param;
+  hdr.h.frame_size = w->frame_size;
+  hdr.h.flags = flags;
+  hdr.h.keyframe = w->keyframe;
+  if (fwrite (&hdr, sizeof (hdr), 1, w->f) != 1)
+    spnr_err (SPNR_FAILURE, "cannot write snapshot file");
+  w->offset = sizeof (hdr);
+
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_init (&w->lock, NULL);
+  pthread_cond_init (&w->not_empty, NULL);
+  pthread_cond_init (&w->not_full, NULL);
+  if (pthread_create (&w->thread, NULL, writer_thread, w))
+    spnr_err (SPNR_FAILURE, "cannot start the snapshot thread");
+#endif
+
+  return w;
+}
+
+/* packs the configuration of sys, blocking while every slot is still
+ * waiting to be written */
+void
+spnr_snap_writer_push (spnr_snap_writer_t * const w,
+                       spnr_sys_t const * const sys)
+{
+  size_t slot;
+
+  if (sys->kind != w->kind || sys->graph->N != w->N
+      || sys->param != w->param)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "system does not match the snapshots");
+
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_lock (&w->lock);
+  while (w->count == SPNR_SNAP_BUFS)
+    pthread_cond_wait (&w->not_full, &w->lock);
+  slot = w->head;
+  pthread_mutex_unlock (&w->lock);
+
+  sys->kind->pack (sys->priv, w->ring[slot], w->N);
+
+  pthread_mutex_lock (&w->lock);
+  w->head = (w->head + 1) % SPNR_SNAP_BUFS;
+  ++w->count;
+  pthread_cond_signal (&w->not_empty);
+  pthread_mutex_unlock (&w->lock);
+#else
+  slot = 0;
+  sys->kind->pack (sys->priv, w->ring[slot], w->N);
+  writer_encode (w, w->ring[slot]);
+#endif
+}
+
+/* writes the pending frames and the index, then closes the file */
+void
+spnr_snap_writer_free (spnr_snap_writer_t * const w)
+{
+  snap_trailer_t tr;
+  size_t i;
+
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_lock (&w->lock);
+  w->done = SPNR_TRUE;
+  pthread_cond_signal (&w->not_empty);
+  pthread_mutex_unlock (&w->lock);
+  pthread_join (w->thread, NULL);
+
+  pthread_mutex_destroy (&w->lock);
+  pthread_cond_destroy (&w->not_empty);
+  pthread_cond_destroy (&w->not_full);
+#endif
+
+  memset (&tr, 0, sizeof (tr));
+  tr.n_frames = w->n_frames;
+  tr.index = w->offset;
+  memcpy (tr.magic, SPNR_SNAP_INDEX_MAGIC, sizeof (tr.magic));
+  if (fwrite (w->index, sizeof (snap_entry_t), w->n_frames, w->f)
+      != w->n_frames
+      || fwrite (&tr, sizeof (tr), 1, w->f) != 1 || fclose (w->f))
+    spnr_err (SPNR_FAILURE, "cannot write snapshot file");
+
+  for (i = 0; i < SPNR_SNAP_BUFS; ++i)
+    free_err (w->ring[i]);
+  free_err (w->prev);
+  free_err (w->enc);
+  free_err (w->index);
+  free_err (w);
+}
+
+/* Reader
+ *
+ * Keeps the last decoded frame: reading frame i decodes from it when
+ * it lies between i and the keyframe of i, from the keyframe
+ * otherwise. */
+
+struct spnr_snap_reader_struct
+{
+  FILE *f;
+  snap_hdr_t hdr;
+  snap_entry_t *index;
+  size_t n_frames;
+  unsigned char *frame;
+  unsigned char *buf;
+  unsigned char *raw;
+  size_t cur;
+};
+
+spnr_snap_reader_t *
+spnr_snap_reader_alloc (char const * const fname)
+{
+  spnr_snap_reader_t * const r = malloc_err (sizeof (spnr_snap_reader_t));
+  snap_trailer_t tr;
+  size_t size;
+
+  r->f = fopen (fname, "rb");
+  if (!r->f)
+    spnr_err (SPNR_FAILURE, "cannot open snapshot file");
+
+  if (fread (&r->hdr, sizeof (r->hdr), 1, r->f) != 1
+      || memcmp (r->hdr.h.magic, SPNR_SNAP_MAGIC, sizeof (r->hdr.h.magic)))
+    spnr_err (SPNR_FAILURE, "not a snapshot file");
+
+  if (fseek (r->f, -(long) sizeof (tr), SEEK_END)
+      || fread (&tr, sizeof (tr), 1, r->f) != 1
+      || memcmp (tr.magic, SPNR_SNAP_INDEX_MAGIC, sizeof (tr.magic)))
+    spnr_err (SPNR_FAILURE, "snapshot file has no index");
+
+  r->n_frames = tr.n_frames;
+  r->index = malloc_err (r->n_frames * sizeof (snap_entry_t));
+  if (fseek (r->f, tr.index, SEEK_SET)
+      || fread (r->index, sizeof (snap_entry_t), r->n_frames, r->f)
+         != r->n_frames)
+    spnr_err (SPNR_FAILURE, "cannot read snapshot index");
+
+  size = r->hdr.h.frame_size;
+  r->frame = malloc_err (size);
+  r->buf = malloc_err (size);
+  r->raw = malloc_err (size + size / 128 + 1);
+  r->cur = r->n_frames;
+
+  return r;
+}
+
+size_t
+spnr_snap_reader_len (spnr_snap_reader_t const * const r)
+{
+  return r->n_frames;
+}
+
+/* reads and decodes frame i into r->buf */
+static void
+reader_load (spnr_snap_reader_t * const r, size_t const i)
+{
+  snap_entry_t const * const e = r->index + i;
+  size_t const size = r->hdr.h.frame_size;
+  unsigned char * const dst = (e->flags & SPNR_SNAP_RLE) ? r->raw : r->buf;
+
+  if (e->len > size + size / 128 + 1 || fseek (r->f, e->offset, SEEK_SET)
+      || fread (dst, 1, e->len, r->f) != e->len)
+    spnr_err (SPNR_FAILURE, "cannot read snapshot frame");
+
+  if (e->flags & SPNR_SNAP_RLE)
+    rle_decode (r->buf, size, r->raw, e->len);
+  else if (e->len != size)
+    spnr_err (SPNR_FAILURE, "corrupted snapshot frame");
+}
+
+/* sets the configuration of sys, which must match the kind, size and
+ * parameter of the snapshots, to frame i */
+void
+spnr_snap_reader_get (spnr_snap_reader_t * const r, size_t const i,
+                      spnr_sys_t * const sys)
+{
+  size_t j, key;
+  size_t const size = r->hdr.h.frame_size;
+
+  if (i >= r->n_frames)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "snapshot index out of bounds");
+  if (strncmp (sys->kind->name, r->hdr.h.kind, SPNR_KIND_NAME_MAX)
+      || sys->graph->N != r->hdr.h.N || sys->param != r->hdr.h.param)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "system does not match the snapshots");
+
+  for (key = i; r->index[key].flags & SPNR_SNAP_DELTA; --key);
+
+  if (r->cur < r->n_frames && r->cur >= key && r->cur <= i)
+    j = r->cur + 1;
+  else
+    {
+      reader_load (r, key);
+      memcpy (r->frame, r->buf, size);
+      j = key + 1;
+    }
+  for (; j <= i; ++j)
+    {
+      reader_load (r, j);
+      xor_frame (r->frame, r->buf, size);
+    }
+  r->cur = i;
+
+  sys->kind->unpack (sys->priv, r->frame, r->hdr.h.N);
+}
+
+void
+spnr_snap_reader_free (spnr_snap_reader_t * const r)
+{
+  fclose (r->f);
+  free_err (r->index);
+  free_err (r->frame);
+  free_err (r->buf);
+  free_err (r->raw);
+  free_err (r);
+}
@@ -44,6 +44,23 @@ typedef struct spnr_graph_struct spnr_graph_t;
 typedef struct spnr_sys_struct spnr_sys_t;
 typedef struct spnr_step_struct spnr_step_t;
 
+/* External field
+ *
+ * Single-site terms added to the pair Hamiltonian:
+ *   - sum_i (h + h_i) . s_i - aniso sum_i (s_i^0)^2
+ * where h is a uniform field, h_i a site-dependent one (both with one
+ * value per spin component, see spnr_sys_n_comps) and the anisotropy
+ * acts on the first spin component. They are evaluated together with
+ * the local field of the pair interaction.
+ */
+
+typedef struct
+{
+  float *uniform;
+  float const *site;
+  float aniso;
+} spnr_field_t;
+
 /* System object
  *
  * Opaque object representing a spin system
@@ -62,14 +79,32 @@ typedef struct
   void (*fill_prop) (void const *priv, void *prop, size_t k);
   void (*accept_prop) (void *priv, void const *prop, size_t k);
   
-  float (*calc_delta_h_binary) (void const *priv, size_t n_sites,
-                                float const *J, size_t const *sites,
-                                void const *prop, size_t k);
-  float (*calc_part_h_binary) (void const* priv, size_t n_sites,
-                               float const *J, size_t const *sites,
-                               size_t k);
+  float (*calc_delta_h_binary) (void const *priv, spnr_field_t const *field,
+                                size_t n_sites, float const *J,
+                                size_t const *sites, void const *prop,
+                                size_t k);
+  /* counts the single-site terms twice, like the bonds, since the graph
+   * halves the sum of the partial energies */
+  float (*calc_part_h_binary) (void const* priv, spnr_field_t const *field,
+                               size_t n_sites, float const *J,
+                               size_t const *sites, size_t k);
   
   float (*calc_phi) (void const *priv, size_t N);
+  
+  size_t (*n_comps) (void const *priv);
+  void (*get_comps) (void const *priv, float *comps, size_t k, size_t count);
+  void (*prop_comps) (void const *priv, void const *prop, float *comps);
+  
+  void (*copy) (void *dst, void const *src, size_t N);
+  
+  /* compact, portable encoding of the configuration (see snapshots) */
+  size_t (*pack_size) (void const *priv, size_t N);
+  void (*pack) (void const *priv, unsigned char *buf, size_t N);
+  void (*unpack) (void *priv, unsigned char const *buf, size_t N);
+  
+  /* optional, count proposals stored contiguously, drawn in one batch
+   * by the steppers when the spectrum is continuous */
+  void (*fill_props) (void const *priv, void *props, size_t count);
 } spnr_sys_kind_t;
 
 struct spnr_sys_struct
@@ -77,21 +112,48 @@ struct spnr_sys_struct
   spnr_sys_kind_t const * kind;
   void *priv;
   size_t N;
+  size_t param;
   spnr_graph_t *graph;
+  spnr_field_t field;
 };
 
 /* Available system kinds */
 
 extern spnr_sys_kind_t const *spnr_ising;
 extern spnr_sys_kind_t const *spnr_nvector;
+extern spnr_sys_kind_t const *spnr_potts;
+extern spnr_sys_kind_t const *spnr_clock;
 
 /* System object methods */
 
 spnr_sys_t * spnr_sys_alloc (spnr_graph_t *graph, spnr_sys_kind_t const * kind, size_t param);
 void spnr_sys_free (spnr_sys_t * sys);
+spnr_sys_t * spnr_sys_clone (spnr_sys_t const * sys);
+void spnr_sys_copy (spnr_sys_t * dst, spnr_sys_t const * src);
 float spnr_sys_spin_size (spnr_sys_t * sys);
 float spnr_sys_calc_h (spnr_sys_t * sys);
 float spnr_sys_calc_phi (spnr_sys_t * sys);
+size_t spnr_sys_n_comps (spnr_sys_t const * sys);
+void spnr_sys_set_field (spnr_sys_t * sys, float const * h);
+void spnr_sys_set_site_field (spnr_sys_t * sys, float const * h);
+void spnr_sys_set_aniso (spnr_sys_t * sys, float aniso);
+void spnr_sys_calc_magn (spnr_sys_t * sys, float * m);
+float spnr_sys_calc_h_field (spnr_sys_t * sys);
+
+/* Graph couplings getter type
+ *
+ * A getter returns the coupling of a given bond. Disordered getters
+ * are pure functions of the seed and of the bond index, so couplings
+ * can be generated in parallel and regenerated from the seed alone
+ */
+
+typedef struct
+{
+  unsigned long seed;
+  float param;
+} spnr_getter_args_t;
+
+typedef float (*spnr_getter_t) (spnr_getter_args_t const *args, size_t bond);
 
 /* Graph object
  *
@@ -102,30 +164,163 @@ float spnr_sys_calc_phi (spnr_sys_t * sys);
 typedef struct
 {
   char const * name;
-  void * (*priv_alloc) (float (*getter)(), size_t N, size_t param);
+  void * (*priv_alloc) (spnr_getter_t getter, spnr_getter_args_t const *args,
+                        size_t N, size_t param);
   void (*priv_free) (void *priv);
   float (*calc_delta_h) (void const *priv, spnr_sys_t const *sys, void const *prop, size_t k);
   float (*calc_h) (void const *priv, size_t N, spnr_sys_t const *sys);
+  void (*save) (void const *priv, size_t N, FILE *f);
+  void * (*map) (void const *data, size_t len, size_t N);
+  size_t (*dims) (void const *priv, size_t *L);
+  size_t (*get_neighbors) (void const *priv, size_t k, size_t *nbrs);
+  void (*get_couplings) (void const *priv, size_t k, float *J);
+  size_t (*n_colors) (void const *priv);
+  size_t (*color) (void const *priv, size_t k);
 } spnr_graph_kind_t;
 
+/* Graphs with neighbor lists copy the at most SPNR_NBRS_MAX neighbors
+ * of a site with get_neighbors, and the couplings of the same bonds,
+ * in the same order, with get_couplings. A coloring splits the sites in
+ * n_colors classes with no bond inside a class, so that the sites of a
+ * class can be updated concurrently; n_colors is 0 when the size of
+ * the graph does not allow the coloring of its kind. */
+
+#define SPNR_NBRS_MAX 32
+
 struct spnr_graph_struct
 {
   spnr_graph_kind_t const * kind;
   void * priv;
   size_t N;
+  spnr_getter_t getter;
+  spnr_getter_args_t args;
+  void *map;
+  size_t map_len;
 };
 
 /* Available graph kinds */
 
 extern spnr_graph_kind_t const *spnr_cubic;
+extern spnr_graph_kind_t const *spnr_powerlaw;
+extern spnr_graph_kind_t const *spnr_triangular;
+extern spnr_graph_kind_t const *spnr_honeycomb;
+extern spnr_graph_kind_t const *spnr_fcc;
+extern spnr_graph_kind_t const *spnr_bcc;
 
 /* System object methods */
 
 spnr_graph_t * spnr_graph_alloc (spnr_graph_kind_t const *kind,
-                                 float (*getter)(),
+                                 spnr_getter_t getter,
                                  size_t N, size_t param);
+spnr_graph_t * spnr_graph_alloc_args (spnr_graph_kind_t const *kind,
+                                      spnr_getter_t getter,
+                                      spnr_getter_args_t const *args,
+                                      size_t N, size_t param);
 void spnr_graph_free (spnr_graph_t *graph);
 
+/* A saved graph can be mapped read-only by any number of threads and
+ * processes, which then share a single physical copy of it. Mapped
+ * graphs have no getter and cannot be modified. */
+
+void spnr_graph_save (spnr_graph_t const *graph, char const *fname);
+spnr_graph_t * spnr_graph_map (char const *fname);
+void spnr_graph_lr_set (spnr_graph_t *graph, float alpha, size_t n_images);
+
+/* Bulk observables
+ *
+ * Computed together in one parallel pass over the system, with double
+ * accumulators. The staggered magnetization needs a bipartite graph (a
+ * two-coloring, or (-1)^(x_1+...+x_D) on uncolored lattices of even L),
+ * the correlation of nearest neighbours s_i . s_j (averaged over the
+ * bonds of the neighbor lists, regardless of the couplings) a graph
+ * with neighbor lists or dims, and the structure factor
+ * S(k) = |sum_i s_i exp(i k . x_i)|^2 / N at the D smallest wave vectors
+ * |k| = 2 pi / L (averaged) a graph with dims; otherwise they are NAN.
+ * With S(0) = N m^2 they give the second moment correlation length
+ * xi = sqrt (S(0) / S(k_min) - 1) / (2 sin (pi / L)).
+ */
+
+#define SPNR_OBS_COMPS_MAX 32
+
+typedef struct
+{
+  size_t n_comps;
+  double e;
+  double m[SPNR_OBS_COMPS_MAX];
+  double m_abs;
+  double m_stag;
+  double nn_corr;
+  double s_kmin;
+} spnr_obs_t;
+
+void spnr_sys_calc_obs (spnr_sys_t *sys, spnr_obs_t *obs);
+
+/* Correlation accumulator
+ *
+ * Running average over probes of the structure factor
+ * S(k) = |sum_i s_i exp(-i k . x_i)|^2 / N on a lattice graph, in
+ * O(N log N) per probe and O(N) memory when L is a power of two, and
+ * O(N L) through a plain DFT otherwise. Both S(k) and G(r) are indexed
+ * like the sites, k = 2 pi x / L and r = x. Call spnr_corr_add after
+ * every probe of a spnr_data_run_and_probe-style loop.
+ */
+
+typedef struct
+{
+  size_t L;
+  size_t D;
+  size_t N;
+  size_t n_samples;
+  double * s_k;
+  
+  /* scratch */
+  double * re;
+  double * im;
+  float * comps;
+  size_t n_comps;
+} spnr_corr_t;
+
+spnr_corr_t * spnr_corr_alloc (spnr_graph_t const *graph);
+void spnr_corr_free (spnr_corr_t *corr);
+void spnr_corr_reset (spnr_corr_t *corr);
+void spnr_corr_add (spnr_corr_t *corr, spnr_sys_t const *sys);
+void spnr_corr_calc_g (spnr_corr_t const *corr, double *g);
+void spnr_corr_write (spnr_corr_t const *corr, char const *fname);
+
+/* Instrumentation counters
+ *
+ * With the library configured with --enable-stats, steppers count
+ * proposals and acceptances and time the phases of their hot loop in
+ * clock ticks (see spnr_stats_tick_ns); data objects time the steps and
+ * the measurements of spnr_data_run_and_probe. Otherwise the hooks are
+ * compiled out and every counter reads zero.
+ */
+
+enum
+{
+  SPNR_PHASE_STEP    = 0, /* whole spnr_step_apply */
+  SPNR_PHASE_PROP    = 1, /* proposal generation (fill_prop) */
+  SPNR_PHASE_DELTA_H = 2, /* local fields and energy change */
+  SPNR_PHASE_ACCEPT  = 3, /* acceptance test and accept_prop */
+  SPNR_PHASE_MEASURE = 4, /* spnr_sys_calc_h and spnr_sys_calc_phi */
+  SPNR_N_PHASES      = 5
+};
+
+typedef struct
+{
+  unsigned long long n_sweeps;
+  unsigned long long n_prop;
+  unsigned long long n_acc;
+  unsigned long long n_clusters;
+  unsigned long long cluster_sites;
+  unsigned long long n_probes;
+  unsigned long long ticks[SPNR_N_PHASES];
+} spnr_stats_t;
+
+int spnr_stats_enabled (void);
+double spnr_stats_tick_ns (void);
+void spnr_stats_write (spnr_stats_t const *stats, FILE *f);
+
 /* Stepper object
  *
  * Opaque object representing a stepper
@@ -137,16 +332,24 @@ typedef struct {
   void * (*priv_alloc) (size_t param);
   void (*priv_free) (void *priv);
   void (*apply) (void *priv, spnr_sys_t const *sys, float beta);
+  float (*acc_rate) (void const *priv);
 } spnr_step_kind_t;
 
 struct spnr_step_struct {
   spnr_step_kind_t const * kind;
   void *priv;
+  spnr_stats_t *stats;
 };
 
 /* Available stepper kinds */
 
 extern spnr_step_kind_t const *spnr_metropolis;
+extern spnr_step_kind_t const *spnr_lr_metropolis;
+extern spnr_step_kind_t const *spnr_wanglandau;
+extern spnr_step_kind_t const *spnr_nfold;
+extern spnr_step_kind_t const *spnr_checkerboard;
+extern spnr_step_kind_t const *spnr_worm;
+extern spnr_step_kind_t const *spnr_demon;
 
 /* System object methods */
 
@@ -154,10 +357,57 @@ spnr_step_t * spnr_step_alloc (spnr_step_kind_t const *kind, size_t param);
 void spnr_step_free (spnr_step_t *step);
 void spnr_step_apply (spnr_step_t const *step, spnr_sys_t const *sys,
                       float beta);
+float spnr_step_acc_rate (spnr_step_t const *step);
+void spnr_step_stats (spnr_step_t const *step, spnr_stats_t *stats);
+void spnr_step_stats_reset (spnr_step_t *step);
+
+/* Memory arena
+ *
+ * All the memory of the library is cache line aligned. While an arena
+ * is bound to a thread, every object that thread allocates (graphs,
+ * systems, steppers, data, ...) is carved out of the arena's single
+ * block instead of the heap, and spnr_arena_free releases them all at
+ * once: such objects need not, and after spnr_arena_free must not, be
+ * freed individually. An arena that runs out of space warns and falls
+ * back to the heap. Scratch memory allocated by later calls while the
+ * arena is still bound is not reclaimed until the arena is freed, so
+ * bind it only while setting up. Arenas are not thread safe.
+ */
+
+#define SPNR_ARENA_HUGEPAGES 1 /* back the arena with huge pages */
+
+typedef struct spnr_arena_struct spnr_arena_t;
+
+typedef struct
+{
+  void * (*alloc) (size_t size, size_t align, void *ctx);
+  void (*free) (void *p, size_t size, void *ctx);
+  void *ctx;
+} spnr_alloc_hook_t;
+
+spnr_arena_t * spnr_arena_alloc (size_t capacity, int flags);
+spnr_arena_t * spnr_arena_alloc_hook (size_t capacity,
+                                      spnr_alloc_hook_t const *hook);
+void spnr_arena_free (spnr_arena_t *arena);
+spnr_arena_t * spnr_arena_bind (spnr_arena_t *arena);
+size_t spnr_arena_used (spnr_arena_t const *arena);
+
+/* Random number generator
+ *
+ * Each thread draws from its own stream; spnr_rng_seed seeds the
+ * stream of the calling thread (spnr_step_alloc seeds it with the
+ * current time).
+ */
+
+void spnr_rng_seed (unsigned long seed);
 
 /* Graph couplings getter functions */
 
-float spnr_ferr ();
+float spnr_ferr (spnr_getter_args_t const *args, size_t bond);
+float spnr_antiferr (spnr_getter_args_t const *args, size_t bond);
+float spnr_bim (spnr_getter_args_t const *args, size_t bond);
+float spnr_gauss (spnr_getter_args_t const *args, size_t bond);
+float spnr_dil (spnr_getter_args_t const *args, size_t bond);
 
 
 /* Data struct
@@ -171,6 +421,7 @@ typedef struct
   size_t size;
   float * h;
   float * phi;
+  spnr_stats_t *stats;
 } spnr_data_t;
 
 /* Data object methods */
@@ -186,6 +437,241 @@ void spnr_data_corr_calc (spnr_data_t *corr, spnr_data_t const *data);
 void spnr_data_run_and_probe (spnr_data_t *data, spnr_sys_t *sys,
                               spnr_step_t const *step,
                               float temp, size_t n_steps_before_probe);
+void spnr_data_stats (spnr_data_t const *data, spnr_stats_t *stats);
+void spnr_data_stats_reset (spnr_data_t *data);
+
+/* Pipelined probing
+ *
+ * Same as spnr_data_run_and_probe, but at every probe the configuration
+ * is copied into one of n_bufs pooled clones of sys (2 if n_bufs is 0)
+ * and measured by a separate thread while the sweeps go on. The hook,
+ * if not NULL, is called on the measurement thread with the snapshot
+ * and the probe index, after h and phi; use it for heavy observables
+ * such as spnr_corr_add. When every buffer is still waiting to be
+ * measured the sweeps block until one is released. Without pthreads
+ * the probes are measured synchronously on a single clone.
+ */
+
+typedef void (*spnr_probe_hook_t) (spnr_sys_t *snap, size_t i, void *ctx);
+
+void spnr_data_run_and_probe_async (spnr_data_t *data, spnr_sys_t *sys,
+                                    spnr_step_t const *step, float temp,
+                                    size_t n_steps_before_probe,
+                                    size_t n_bufs, spnr_probe_hook_t hook,
+                                    void *ctx);
+
+/* Configuration snapshots
+ *
+ * Appends configurations to a binary file through the compact encoding
+ * of the system kind: one bit per spin for Ising, one byte for Potts
+ * and clock, int16 components for n-vector. With SPNR_SNAP_DELTA every
+ * frame but one keyframe each `keyframe` (64 if 0) stores the XOR with
+ * the previous one, and with SPNR_SNAP_RLE frames are run length
+ * encoded. Encoding and output run on a background thread, so
+ * spnr_snap_writer_push only costs the packing. An index at the end of
+ * the file, written by spnr_snap_writer_free, gives random access to
+ * every frame; consecutive reads decode incrementally.
+ */
+
+#define SPNR_SNAP_DELTA 1
+#define SPNR_SNAP_RLE 2
+
+typedef struct spnr_snap_writer_struct spnr_snap_writer_t;
+typedef struct spnr_snap_reader_struct spnr_snap_reader_t;
+
+spnr_snap_writer_t * spnr_snap_writer_alloc (char const *fname,
+                                             spnr_sys_t const *sys,
+                                             int flags, size_t keyframe);
+void spnr_snap_writer_push (spnr_snap_writer_t *writer,
+                            spnr_sys_t const *sys);
+void spnr_snap_writer_free (spnr_snap_writer_t *writer);
+spnr_snap_reader_t * spnr_snap_reader_alloc (char const *fname);
+size_t spnr_snap_reader_len (spnr_snap_reader_t const *reader);
+void spnr_snap_reader_get (spnr_snap_reader_t *reader, size_t i,
+                           spnr_sys_t *sys);
+void spnr_snap_reader_free (spnr_snap_reader_t *reader);
+
+/* Scan struct
+ *
+ * Summary table of a scan over a grid x of temperatures, or of
+ * uniform fields along the first spin component at fixed temperature
+ */
+
+#define SPNR_SCAN_TEMP 0
+#define SPNR_SCAN_FIELD 1
+
+typedef struct
+{
+  size_t size;
+  float * x;
+  float * h_mean;
+  float * h_var;
+  float * phi_mean;
+  float * phi_var;
+  float * c;
+  float * chi;
+  float * binder;
+  size_t * n_equil;
+} spnr_scan_t;
+
+/* Scan object methods */
+
+spnr_scan_t * spnr_scan_alloc (size_t size);
+void spnr_scan_free (spnr_scan_t *scan);
+void spnr_scan_write (spnr_scan_t const *scan, char const *fname);
+void spnr_scan_summary (spnr_scan_t *scan, size_t i, spnr_data_t const *data,
+                        float beta, size_t N);
+void spnr_scan_run (spnr_scan_t *scan, spnr_sys_t const *sys,
+                    spnr_step_kind_t const *step_kind, int mode, float temp,
+                    size_t n_probes, size_t n_steps_before_probe,
+                    unsigned long seed);
+
+/* Population annealing
+ *
+ * Cools a population of R replicas of sys through the temperatures in
+ * out->x, resampling it at every step, and fills the rows of out with
+ * population averages. ln_z, if not NULL, receives ln Z(T_k) / Z(T_0)
+ * and s_family, if not NULL, the entropy of the family sizes.
+ */
+
+void spnr_pa_run (spnr_scan_t *out, double *ln_z, double *s_family,
+                  spnr_sys_t const *sys, spnr_step_kind_t const *step_kind,
+                  size_t R, size_t n_sweeps, unsigned long seed);
+
+/* Histogram reweighting
+ *
+ * Fill the rows of a scan table at the temperatures in out->x from
+ * the probes of one run at temperature temp, or of n_runs runs at
+ * temperatures temps, of a system of N sites
+ */
+
+void spnr_reweight (spnr_scan_t *out, spnr_data_t const *data, float temp,
+                    size_t N);
+void spnr_reweight_multi (spnr_scan_t *out, spnr_data_t const * const *data,
+                          float const *temps, size_t n_runs, size_t N);
+
+/* Resampling error analysis
+ *
+ * Jackknife and bootstrap estimates of derived observables over n_series
+ * runs. Each series is cut into n_bins bins (a tail shorter than a bin
+ * is dropped) and an estimator is a function of the moments of the
+ * probes of every series, like the columns of spnr_scan_summary; the
+ * n_est estimators share ctx. Jackknife sample j drops bin j of every
+ * series, and its estimate is bias corrected; bootstrap samples draw
+ * n_bins bins with replacement in each series, and the estimate is the
+ * one of the full data. The resamples run in parallel, with streams
+ * derived from seed. The spnr_est_* estimators act on the first series
+ * and take a spnr_est_args_t as ctx.
+ */
+
+typedef struct
+{
+  double h;
+  double h2;
+  double m;
+  double m2;
+  double m4;
+} spnr_moments_t;
+
+typedef double (*spnr_estimator_t) (spnr_moments_t const *mom,
+                                    size_t n_series, void const *ctx);
+
+typedef struct
+{
+  double beta;
+  size_t N;
+} spnr_est_args_t;
+
+void spnr_jackknife (double *est, double *err,
+                     spnr_data_t const * const *data, size_t n_series,
+                     size_t n_bins, spnr_estimator_t const *f, size_t n_est,
+                     void const *ctx);
+void spnr_bootstrap (double *est, double *err,
+                     spnr_data_t const * const *data, size_t n_series,
+                     size_t n_bins, spnr_estimator_t const *f, size_t n_est,
+                     void const *ctx, size_t n_boot, unsigned long seed);
+
+double spnr_est_e (spnr_moments_t const *mom, size_t n_series,
+                   void const *ctx);
+double spnr_est_m (spnr_moments_t const *mom, size_t n_series,
+                   void const *ctx);
+double spnr_est_c (spnr_moments_t const *mom, size_t n_series,
+                   void const *ctx);
+double spnr_est_chi (spnr_moments_t const *mom, size_t n_series,
+                     void const *ctx);
+double spnr_est_binder (spnr_moments_t const *mom, size_t n_series,
+                        void const *ctx);
+
+/* Wang-Landau stepper methods
+ *
+ * Energies are per site; the range [e_min, e_max) is split in n_bins
+ */
+
+void spnr_wl_set_range (spnr_step_t *step, double e_min, double e_max,
+                        size_t n_bins);
+void spnr_wl_set_muca (spnr_step_t *step, int muca);
+double spnr_wl_ln_f (spnr_step_t const *step);
+void spnr_wl_get_ln_g (spnr_step_t const *step, double *ln_g);
+void spnr_wl_get_hist (spnr_step_t const *step, size_t *hist);
+void spnr_wl_thermo (spnr_scan_t *out, double const *ln_g, double e_min,
+                     double e_max, size_t n_bins, size_t N);
+void spnr_wl_muca_reweight (spnr_scan_t *out, spnr_step_t const *step,
+                            spnr_data_t const *data, size_t N);
+void spnr_wl_windows_run (double *ln_g, spnr_sys_t const *sys, double e_min,
+                          double e_max, size_t n_bins, size_t n_windows,
+                          double overlap, double ln_f_final, size_t n_sweeps,
+                          unsigned long seed);
+
+/* n-fold way stepper methods
+ *
+ * Rejection-free continuous time dynamics of Ising spins on graphs with
+ * neighbor lists, equivalent to random sequential Metropolis: each
+ * apply advances the clock by one sweep, i.e. N attempts. Site rates
+ * are cached between applies on the same system at the same beta and
+ * field, and rebuilt when the uniform field, the site field pointer or
+ * the anisotropy change; call spnr_nfold_reset after changing the
+ * configuration or the values of a site field by other means.
+ */
+
+double spnr_nfold_time (spnr_step_t const *step);
+void spnr_nfold_reset (spnr_step_t *step);
+
+/* Worm stepper methods
+ *
+ * Worm algorithm for Ising spins on cubic graphs with non-negative
+ * couplings and no field. The stepper keeps its own configuration, the
+ * bond occupations of the high temperature expansion, and after each
+ * apply writes to the system an equilibrium spin configuration drawn
+ * from it; an apply does about N worm updates. Every update adds to the
+ * estimates of G(r) (indexed like the sites), of its sum
+ * chi = N <m^2>, of the second moment correlation length and of the
+ * energy per site. They are cleared when beta or the system change,
+ * and by spnr_worm_reset.
+ */
+
+void spnr_worm_reset (spnr_step_t *step);
+double spnr_worm_chi (spnr_step_t const *step);
+double spnr_worm_xi (spnr_step_t const *step);
+double spnr_worm_energy (spnr_step_t const *step);
+void spnr_worm_calc_g (spnr_step_t const *step, double *g);
+
+/* Demon stepper methods
+ *
+ * Microcanonical dynamics with one Creutz demon per block of sites: the
+ * beta passed to spnr_step_apply is ignored, the energy of the system
+ * plus the demons is conserved and the temperature is measured from the
+ * demon energies, sampled before every move. Demons start with energy
+ * 0, or the one set by spnr_demon_set_energy, which also applies to the
+ * demons of systems stepped later. spnr_demon_temp takes the spacing of
+ * the demon energies, e.g. 4 J for Ising on square lattices, or 0 for a
+ * continuous spectrum; it assumes the heat capacity of the system to be
+ * large compared to 1, as it is on large lattices.
+ */
+
+void spnr_demon_set_energy (spnr_step_t *step, double e);
+void spnr_demon_reset (spnr_step_t *step);
+double spnr_demon_energy (spnr_step_t const *step);
+double spnr_demon_temp (spnr_step_t const *step, double quantum);
 
 END_C_DECLS
 
@@ -0,0 +1,119 @@
+/* stats.c
+ * 
+ * Copyright (C) 2024 L. Bertini
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+
+#include "spinner.h"
+#include "stats.h"
+
+#define SPNR_STATS_CALIB_NS 10000000
+
+#ifdef SPNR_STATS
+_Thread_local spnr_stats_t *spnr_stats_cur = NULL;
+#endif
+
+int
+spnr_stats_enabled (void)
+{
+#ifdef SPNR_STATS
+  return SPNR_TRUE;
+#else
+  return SPNR_FALSE;
+#endif
+}
+
+#ifdef SPNR_STATS
+static double
+wall_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return 1e9 * ts.tv_sec + ts.tv_nsec;
+}
+#endif
+
+/* length of a tick in nanoseconds; with the time stamp counter it is
+ * calibrated once against the monotonic clock over 10 ms */
+double
+spnr_stats_tick_ns (void)
+{
+#if defined(SPNR_STATS) && (defined(__x86_64__) || defined(__i386__))
+  static double tick_ns = 0;
+  double t0, t1;
+  uint64_t c0, c1;
+
+  if (tick_ns == 0)
+    {
+      t0 = wall_ns ();
+      c0 = spnr_stats_clock ();
+      do
+        t1 = wall_ns ();
+      while (t1 - t0 < SPNR_STATS_CALIB_NS);
+      c1 = spnr_stats_clock ();
+      tick_ns = (t1 - t0) / (c1 - c0);
+    }
+
+  return tick_ns;
+#else
+  return 1;
+#endif
+}
+
+void
+spnr_stats_write (spnr_stats_t const * const stats, FILE * const f)
+{
+  static char const * const names[SPNR_N_PHASES] =
+    { "step", "prop", "delta_h", "accept", "measure" };
+  double const tick_ns = spnr_stats_tick_ns ();
+  size_t p;
+
+  fprintf (f, "sweeps %llu probes %llu proposals %llu accepted %llu",
+           stats->n_sweeps, stats->n_probes, stats->n_prop, stats->n_acc);
+  if (stats->n_prop > 0)
+    fprintf (f, " (%.4f)", (double) stats->n_acc / stats->n_prop);
+  fprintf (f, "\nclusters %llu sites %llu\n", stats->n_clusters,
+           stats->cluster_sites);
+  for (p = 0; p < SPNR_N_PHASES; ++p)
+    fprintf (f, "%-8s %14llu ticks %12.3f ms\n", names[p], stats->ticks[p],
+             1e-6 * tick_ns * stats->ticks[p]);
+}
+
+void
+spnr_step_stats (spnr_step_t const * const step, spnr_stats_t * const stats)
+{
+  memcpy (stats, step->stats, sizeof (spnr_stats_t));
+}
+
+void
+spnr_step_stats_reset (spnr_step_t * const step)
+{
+  memset (step->stats, 0, sizeof (spnr_stats_t));
+}
+
+void
+spnr_data_stats (spnr_data_t const * const data, spnr_stats_t * const stats)
+{
+  memcpy (stats, data->stats, sizeof (spnr_stats_t));
+}
+
+void
+spnr_data_stats_reset (spnr_data_t * const data)
+{
+  memset (data->stats, 0, sizeof (spnr_stats_t));
+}
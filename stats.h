@@ -0,0 +1,92 @@
+/* stats.h
+ * 
+ * Copyright (C) 2024 L. Bertini
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "spinner.h"
+
+#undef BEGIN_C_DECLS
+#undef END_C_DECLS
+#ifdef __cplusplus
+# define BEGIN_C_DECLS extern "C" {
+# define END_C_DECLS }
+#else
+# define BEGIN_C_DECLS /* empty */
+# define END_C_DECLS /* empty */
+#endif
+
+BEGIN_C_DECLS
+
+/* Instrumentation hooks for the hot paths
+ *
+ * spnr_step_apply points spnr_stats_cur to the counters of the stepper
+ * being applied, so that kernels can record into it without having the
+ * step object at hand. Without SPNR_STATS every hook expands to nothing
+ * and the counters are never touched. */
+
+#ifdef SPNR_STATS
+
+extern _Thread_local spnr_stats_t *spnr_stats_cur;
+
+static inline uint64_t
+spnr_stats_clock (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc ();
+#else
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+# define SPNR_STATS_BIND(st) (spnr_stats_cur = (st))
+# define SPNR_STATS_VAR(t) uint64_t t
+# define SPNR_STATS_TIC(t) ((t) = spnr_stats_clock ())
+# define SPNR_STATS_ADD(field, n) (spnr_stats_cur->field += (n))
+/* charges the ticks since the last TIC or LAP to phase and restarts */
+# define SPNR_STATS_LAP(t, phase) \
+  do \
+    { \
+      uint64_t const now_ = spnr_stats_clock (); \
+      spnr_stats_cur->ticks[phase] += now_ - (t); \
+      (t) = now_; \
+    } \
+  while (0)
+
+#else
+
+# define SPNR_STATS_BIND(st) ((void) 0)
+# define SPNR_STATS_VAR(t) /* empty */
+# define SPNR_STATS_TIC(t) ((void) 0)
+# define SPNR_STATS_ADD(field, n) ((void) 0)
+# define SPNR_STATS_LAP(t, phase) ((void) 0)
+
+#endif
+
+END_C_DECLS
+
+#endif
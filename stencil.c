@@ -0,0 +1,461 @@
+/* stencil.c
+ * 
+ * Copyright (C) 2024 L. Bertini
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "spinner.h"
+#include "error.h"
+#include "internal.h"
+#include "graphio.h"
+
+/* Stencil lattices
+ *
+ * Periodic lattices whose neighbors are computed from the coordinates
+ * of a site instead of being stored. The Bravais lattices (triangular,
+ * FCC, BCC) use L^D sites in primitive coordinates, first coordinate
+ * running fastest like the cubic graph; a site owns the bonds towards
+ * the zh forward offsets of its stencil, the other zh come from the
+ * sites behind it. The honeycomb lattice has two sites per cell of an
+ * L x L triangular Bravais lattice, N = 2 L^2, and its A sites own the
+ * three bonds. Only the couplings are stored, one per bond, and the
+ * getter is called with bond index owner * zh + b. The param of
+ * spnr_graph_alloc is unused.
+ *
+ * The colorings are (sum_d w_d x_d) mod n_colors for the Bravais
+ * lattices, valid when L is a multiple of n_colors, and the sublattice
+ * for the honeycomb one. */
+
+#define STENCIL_ZH_MAX 6
+
+typedef struct
+{
+  size_t D;
+  size_t zh;
+  signed char off[STENCIL_ZH_MAX][3];
+  size_t n_colors;
+  size_t w[3];
+} stencil_t;
+
+static stencil_t const tri_stencil =
+{
+  2, 3, { { 1, 0 }, { 0, 1 }, { 1, -1 } }, 3, { 1, 2 }
+};
+
+static stencil_t const fcc_stencil =
+{
+  3, 6,
+  { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 },
+    { 1, -1, 0 }, { 0, 1, -1 }, { 1, 0, -1 } },
+  4, { 1, 2, 3 }
+};
+
+static stencil_t const bcc_stencil =
+{
+  3, 4, { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 }, { 1, 1, 1 } },
+  2, { 1, 1, 1 }
+};
+
+static stencil_t const honeycomb_stencil =
+{
+  2, 3, { { 0, 0 }, { -1, 0 }, { 0, -1 } }, 2, { 0, 0 }
+};
+
+typedef struct
+{
+  stencil_t const *st;
+  size_t L;
+  double inv_L;
+  size_t N;
+  float *J;
+  int mapped;
+} stencil_priv_t;
+
+/* saved graph: this header, then J */
+typedef union
+{
+  struct
+  {
+    uint64_t L;
+  } h;
+  char pad[SPNR_FILE_ALIGN];
+} stencil_file_t;
+
+/* i / L, by a multiplication: integer division would dominate the cost
+ * of the stencils */
+static inline size_t
+div_L (stencil_priv_t const * const priv, size_t const i)
+{
+  size_t q = i * priv->inv_L;
+
+  q -= (q * priv->L > i);
+  q += ((q + 1) * priv->L <= i);
+  return q;
+}
+
+static inline size_t
+wrap (long const x, size_t const L)
+{
+  return x < 0 ? x + L : (size_t) x >= L ? x - L : (size_t) x;
+}
+
+/* Neighbors and couplings of site k; every kind calls these with a
+ * constant stencil, so that they are unrolled per coordination. */
+
+static inline void
+bravais_gather (stencil_priv_t const * const priv, stencil_t const * const st,
+                size_t const k, size_t * const sites, float * const J)
+{
+  size_t b, d, q, x, i = k, unit = 1, fwd, bwd;
+  size_t const L = priv->L, D = st->D, zh = st->zh;
+  size_t up[3], down[3];
+
+  /* the steps by +1 and -1 along each axis, wrapped; offsets are all
+   * in {-1, 0, 1} */
+  for (d = 0; d < D; ++d, unit *= L)
+    {
+      q = div_L (priv, i);
+      x = i - q * L;
+      i = q;
+      up[d] = (x == L - 1) ? - (L - 1) * unit : unit;
+      down[d] = x ? - unit : (L - 1) * unit;
+    }
+
+  for (b = 0; b < zh; ++b)
+    {
+      fwd = bwd = k;
+      for (d = 0; d < D; ++d)
+        if (st->off[b][d] > 0)
+          {
+            fwd += up[d];
+            bwd += down[d];
+          }
+        else if (st->off[b][d] < 0)
+          {
+            fwd += down[d];
+            bwd += up[d];
+          }
+      sites[b] = fwd;
+      J[b] = priv->J[k * zh + b];
+      sites[zh + b] = bwd;
+      J[zh + b] = priv->J[bwd * zh + b];
+    }
+}
+
+static inline void
+honeycomb_gather (stencil_priv_t const * const priv, size_t const k,
+                  size_t * const sites, float * const J)
+{
+  size_t b, c;
+  size_t const L = priv->L, cell = k / 2;
+  long const y = div_L (priv, cell), x = cell - y * L;
+  signed char const (* const off)[3] = honeycomb_stencil.off;
+
+  /* an A site reaches the B sites at the offsets, a B site the A sites
+   * at the opposite ones */
+  for (b = 0; b < 3; ++b)
+    if (k % 2 == 0)
+      {
+        c = wrap (x + off[b][0], L) + L * wrap (y + off[b][1], L);
+        sites[b] = 2 * c + 1;
+        J[b] = priv->J[cell * 3 + b];
+      }
+    else
+      {
+        c = wrap (x - off[b][0], L) + L * wrap (y - off[b][1], L);
+        sites[b] = 2 * c;
+        J[b] = priv->J[c * 3 + b];
+      }
+}
+
+static inline void
+tri_gather (stencil_priv_t const * const priv, size_t const k,
+            size_t * const sites, float * const J)
+{
+  bravais_gather (priv, &tri_stencil, k, sites, J);
+}
+
+static inline void
+fcc_gather (stencil_priv_t const * const priv, size_t const k,
+            size_t * const sites, float * const J)
+{
+  bravais_gather (priv, &fcc_stencil, k, sites, J);
+}
+
+static inline void
+bcc_gather (stencil_priv_t const * const priv, size_t const k,
+            size_t * const sites, float * const J)
+{
+  bravais_gather (priv, &bcc_stencil, k, sites, J);
+}
+
+static stencil_priv_t *
+priv_alloc_common (stencil_t const * const st, spnr_getter_t const getter,
+                   spnr_getter_args_t const * const args, size_t const N)
+{
+  stencil_priv_t * const priv = malloc_err (sizeof (stencil_priv_t));
+  size_t const cells = (st == &honeycomb_stencil) ? N / 2 : N;
+  size_t i, n_bonds;
+
+  priv->st = st;
+  priv->N = N;
+  priv->L = nearbyint (pow (cells, 1.0 / st->D));
+  priv->inv_L = 1.0 / priv->L;
+  if (priv->L < 3 || pow (priv->L, st->D) != cells
+      || (st == &honeycomb_stencil && N % 2))
+    spnr_err (SPNR_ERROR_PARAM_OOB, "N does not fit the lattice");
+
+  n_bonds = cells * st->zh;
+  priv->J = malloc_err (n_bonds * sizeof (float));
+  priv->mapped = SPNR_FALSE;
+
+#pragma omp parallel for if (n_bonds >= SPNR_PAR_MIN)
+  for (i = 0; i < n_bonds; ++i)
+    priv->J[i] = getter (args, i);
+
+  return priv;
+}
+
+static void
+priv_free (void * const priv)
+{
+  stencil_priv_t * const priv_ = (stencil_priv_t *) priv;
+  if (!priv_->mapped)
+    free_err (priv_->J);
+  free_err (priv_);
+}
+
+static size_t
+n_bonds (stencil_priv_t const * const priv)
+{
+  return priv->N / (priv->st == &honeycomb_stencil ? 2 : 1) * priv->st->zh;
+}
+
+static void
+save (void const * const priv, size_t const N, FILE * const f)
+{
+  stencil_priv_t const * const priv_ = (stencil_priv_t *) priv;
+  stencil_file_t hdr;
+
+  (void) N;
+  memset (&hdr, 0, sizeof (hdr));
+  hdr.h.L = priv_->L;
+  spnr_file_write (f, &hdr, sizeof (hdr));
+  spnr_file_write (f, priv_->J, n_bonds (priv_) * sizeof (float));
+}
+
+static stencil_priv_t *
+map_common (stencil_t const * const st, void const * const data,
+            size_t const len, size_t const N)
+{
+  stencil_file_t const * const hdr = (stencil_file_t const *) data;
+  stencil_priv_t * const priv = malloc_err (sizeof (stencil_priv_t));
+
+  priv->st = st;
+  priv->N = N;
+  priv->L = hdr->h.L;
+  priv->inv_L = 1.0 / priv->L;
+  priv->J = (float *) (hdr + 1);
+  priv->mapped = SPNR_TRUE;
+
+  if (len < sizeof (stencil_file_t) + n_bonds (priv) * sizeof (float))
+    spnr_err (SPNR_FAILURE, "truncated graph file");
+
+  return priv;
+}
+
+static size_t
+dims (void const * const priv, size_t * const L)
+{
+  stencil_priv_t const * const priv_ = (stencil_priv_t *) priv;
+  *L = priv_->L;
+  return priv_->st->D;
+}
+
+static size_t
+n_colors (void const * const priv)
+{
+  stencil_priv_t const * const priv_ = (stencil_priv_t *) priv;
+  size_t const q = priv_->st->n_colors;
+
+  return (priv_->st == &honeycomb_stencil || priv_->L % q == 0) ? q : 0;
+}
+
+static size_t
+color (void const * const priv, size_t const k)
+{
+  stencil_priv_t const * const priv_ = (stencil_priv_t *) priv;
+  stencil_t const * const st = priv_->st;
+  size_t d, x = k, c = 0;
+
+  if (st == &honeycomb_stencil)
+    return k % 2;
+
+  for (d = 0; d < st->D; ++d, x /= priv_->L)
+    c += st->w[d] * (x % priv_->L);
+
+  return c % st->n_colors;
+}
+
+/* Per kind entry points, with the coordination z fixed at compile
+ * time */
+
+#define STENCIL_KIND(name, st, z, gather)                                   \
+static void *                                                               \
+name##_priv_alloc (spnr_getter_t const getter,                              \
+                   spnr_getter_args_t const * const args,                   \
+                   size_t const N, size_t const param)                      \
+{                                                                           \
+  (void) param;                                                             \
+  return priv_alloc_common (&st, getter, args, N);                          \
+}                                                                           \
+                                                                            \
+static void *                                                               \
+name##_map (void const * const data, size_t const len, size_t const N)      \
+{                                                                           \
+  return map_common (&st, data, len, N);                                    \
+}                                                                           \
+                                                                            \
+static float                                                                \
+name##_calc_delta_h (void const * const priv, spnr_sys_t const * const sys, \
+                     void const * const prop, size_t const k)               \
+{                                                                           \
+  size_t sites[z];                                                          \
+  float J[z];                                                               \
+                                                                            \
+  gather ((stencil_priv_t *) priv, k, sites, J);                            \
+  return sys->kind->calc_delta_h_binary (sys->priv, &sys->field, z, J,      \
+                                         sites, prop, k);                   \
+}                                                                           \
+                                                                            \
+static float                                                                \
+name##_calc_h (void const * const priv, size_t const N,                     \
+               spnr_sys_t const * const sys)                                \
+{                                                                           \
+  size_t i;                                                                 \
+  size_t sites[z];                                                          \
+  float J[z];                                                               \
+  double h = 0;                                                             \
+                                                                            \
+_Pragma ("omp parallel for private (sites, J) reduction (+:h)               \
+         if (N >= SPNR_PAR_MIN)")                                           \
+  for (i = 0; i < N; ++i)                                                   \
+    {                                                                       \
+      gather ((stencil_priv_t *) priv, i, sites, J);                        \
+      h += sys->kind->calc_part_h_binary (sys->priv, &sys->field, z, J,     \
+                                          sites, i);                        \
+    }                                                                       \
+                                                                            \
+  return h / (2.0 * N);                                                     \
+}                                                                           \
+                                                                            \
+static size_t                                                               \
+name##_get_neighbors (void const * const priv, size_t const k,              \
+                      size_t * const nbrs)                                  \
+{                                                                           \
+  float J[z];                                                               \
+                                                                            \
+  gather ((stencil_priv_t *) priv, k, nbrs, J);                             \
+  return z;                                                                 \
+}                                                                           \
+                                                                            \
+static void                                                                 \
+name##_get_couplings (void const * const priv, size_t const k,              \
+                      float * const J)                                      \
+{                                                                           \
+  size_t sites[z];                                                          \
+                                                                            \
+  gather ((stencil_priv_t *) priv, k, sites, J);                            \
+}
+
+STENCIL_KIND (tri, tri_stencil, 6, tri_gather)
+STENCIL_KIND (honeycomb, honeycomb_stencil, 3, honeycomb_gather)
+STENCIL_KIND (fcc, fcc_stencil, 12, fcc_gather)
+STENCIL_KIND (bcc, bcc_stencil, 8, bcc_gather)
+
+static const spnr_graph_kind_t triangular_kind =
+{
+  "triangular",
+  &tri_priv_alloc,
+  &priv_free,
+  &tri_calc_delta_h,
+  &tri_calc_h,
+  &save,
+  &tri_map,
+  &dims,
+  &tri_get_neighbors,
+  &tri_get_couplings,
+  &n_colors,
+  &color
+};
+
+/* no dims: the two sites of a cell do not fit the FFT layout */
+static const spnr_graph_kind_t honeycomb_kind =
+{
+  "honeycomb",
+  &honeycomb_priv_alloc,
+  &priv_free,
+  &honeycomb_calc_delta_h,
+  &honeycomb_calc_h,
+  &save,
+  &honeycomb_map,
+  NULL,
+  &honeycomb_get_neighbors,
+  &honeycomb_get_couplings,
+  &n_colors,
+  &color
+};
+
+static const spnr_graph_kind_t fcc_kind =
+{
+  "fcc",
+  &fcc_priv_alloc,
+  &priv_free,
+  &fcc_calc_delta_h,
+  &fcc_calc_h,
+  &save,
+  &fcc_map,
+  &dims,
+  &fcc_get_neighbors,
+  &fcc_get_couplings,
+  &n_colors,
+  &color
+};
+
+static const spnr_graph_kind_t bcc_kind =
+{
+  "bcc",
+  &bcc_priv_alloc,
+  &priv_free,
+  &bcc_calc_delta_h,
+  &bcc_calc_h,
+  &save,
+  &bcc_map,
+  &dims,
+  &bcc_get_neighbors,
+  &bcc_get_couplings,
+  &n_colors,
+  &color
+};
+
+const spnr_graph_kind_t *spnr_triangular = &triangular_kind;
+const spnr_graph_kind_t *spnr_honeycomb = &honeycomb_kind;
+const spnr_graph_kind_t *spnr_fcc = &fcc_kind;
+const spnr_graph_kind_t *spnr_bcc = &bcc_kind;
@@ -18,17 +18,21 @@
  */
 
 #include <time.h>
+#include <math.h>
 
 #include "spinner.h"
 #include "error.h"
+#include "stats.h"
 
 spnr_step_t *
 spnr_step_alloc (spnr_step_kind_t const * const kind, size_t const param)
 {
-  srand (time(0));
+  spnr_rng_seed (time(0));
   spnr_step_t * step = malloc_err (sizeof (spnr_step_t));
   step->kind = kind;
   step->priv = kind->priv_alloc (param);
+  step->stats = malloc_err (sizeof (spnr_stats_t));
+  spnr_step_stats_reset (step);
   
   return step;
 }
@@ -37,7 +41,8 @@ void
 spnr_step_free (spnr_step_t * const step)
 {
   step->kind->priv_free (step->priv);
-  free (step);
+  free_err (step->stats);
+  free_err (step);
 }
 
 void
@@ -45,5 +50,21 @@ spnr_step_apply (spnr_step_t const * const step,
                  spnr_sys_t const * const sys,
                  float const beta)
 {
+  SPNR_STATS_VAR (t);
+  
+  SPNR_STATS_BIND (step->stats);
+  SPNR_STATS_TIC (t);
   step->kind->apply(step->priv, sys, beta);
-}
\ No newline at end of file
+  SPNR_STATS_LAP (t, SPNR_PHASE_STEP);
+  SPNR_STATS_ADD (n_sweeps, 1);
+}
+
+/* fraction of the proposals accepted during the last apply, NAN if the
+ * stepper does not keep track of it */
+float
+spnr_step_acc_rate (spnr_step_t const * const step)
+{
+  if (!step->kind->acc_rate)
+    return NAN;
+  return step->kind->acc_rate (step->priv);
+}
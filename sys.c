@@ -1,12 +1,21 @@
+#include <string.h>
+
 #include "spinner.h"
+#include "error.h"
+#include "internal.h"
 
 spnr_sys_t *
 spnr_sys_alloc (spnr_graph_t * graph, spnr_sys_kind_t const * kind, size_t param)
 {
-  spnr_sys_t * sys = malloc (sizeof (spnr_sys_t));
+  spnr_sys_t * sys = malloc_err (sizeof (spnr_sys_t));
   sys->graph = graph;
   sys->kind = kind;
+  sys->N = graph->N;
+  sys->param = param;
   sys->priv = kind->priv_alloc (graph->N, param);
+  sys->field.uniform = NULL;
+  sys->field.site = NULL;
+  sys->field.aniso = 0;
   
   return sys;
 }
@@ -15,7 +24,35 @@ void
 spnr_sys_free (spnr_sys_t * sys)
 {
   sys->kind->priv_free(sys->priv);
-  free (sys);
+  free_err (sys->field.uniform);
+  free_err (sys);
+}
+
+/* new system on the same graph, with the same configuration and
+ * field; a site-dependent field is shared, not copied */
+spnr_sys_t *
+spnr_sys_clone (spnr_sys_t const * sys)
+{
+  spnr_sys_t * const clone = spnr_sys_alloc (sys->graph, sys->kind, sys->param);
+  
+  spnr_sys_copy (clone, sys);
+  spnr_sys_set_field (clone, sys->field.uniform);
+  clone->field.site = sys->field.site;
+  clone->field.aniso = sys->field.aniso;
+  
+  return clone;
+}
+
+/* copies the configuration of src, which must be of the same kind and
+ * on a graph of the same size */
+void
+spnr_sys_copy (spnr_sys_t * dst, spnr_sys_t const * src)
+{
+  if (dst->kind != src->kind || dst->graph->N != src->graph->N
+      || dst->param != src->param)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "systems are not compatible");
+  
+  dst->kind->copy (dst->priv, src->priv, src->graph->N);
 }
 
 float
@@ -33,4 +70,101 @@ float spnr_sys_calc_h (spnr_sys_t * sys)
 float spnr_sys_calc_phi (spnr_sys_t * sys)
 {
   return sys->kind->calc_phi (sys->priv, sys->graph->N);
-}
\ No newline at end of file
+}
+
+size_t
+spnr_sys_n_comps (spnr_sys_t const * sys)
+{
+  return sys->kind->n_comps (sys->priv);
+}
+
+/* copies h, one value per spin component; NULL removes the field */
+void
+spnr_sys_set_field (spnr_sys_t * sys, float const * h)
+{
+  size_t const n = spnr_sys_n_comps (sys);
+  
+  free_err (sys->field.uniform);
+  sys->field.uniform = NULL;
+  if (h)
+    {
+      sys->field.uniform = malloc_err (n * sizeof (float));
+      memcpy (sys->field.uniform, h, n * sizeof (float));
+    }
+}
+
+/* h holds N * n_comps values and is not copied: it must outlive sys */
+void
+spnr_sys_set_site_field (spnr_sys_t * sys, float const * h)
+{
+  sys->field.site = h;
+}
+
+void
+spnr_sys_set_aniso (spnr_sys_t * sys, float aniso)
+{
+  sys->field.aniso = aniso;
+}
+
+/* magnetization vector per site, m must hold n_comps values */
+void
+spnr_sys_calc_magn (spnr_sys_t * sys, float * m)
+{
+  size_t i, j, c, count;
+  size_t const N = sys->graph->N, n = spnr_sys_n_comps (sys);
+  float * const buf = malloc_err (SPNR_CHUNK * n * sizeof (float));
+  double * const sum = malloc_err (n * sizeof (double));
+  
+  memset (sum, 0, n * sizeof (double));
+  for (i = 0; i < N; i += SPNR_CHUNK)
+    {
+      count = (N - i < SPNR_CHUNK) ? N - i : SPNR_CHUNK;
+      sys->kind->get_comps (sys->priv, buf, i, count);
+      for (j = 0; j < count; ++j)
+        for (c = 0; c < n; ++c)
+          sum[c] += buf[j * n + c];
+    }
+  
+  for (c = 0; c < n; ++c)
+    m[c] = sum[c] / N;
+  
+  free_err (buf);
+  free_err (sum);
+}
+
+/* energy per site of the single-site terms alone; the pair energy is
+ * spnr_sys_calc_h minus this. With the magnetization it allows to
+ * reweight a run to nearby uniform fields, since
+ * H(h') = H(h) - N (h' - h) . m */
+float
+spnr_sys_calc_h_field (spnr_sys_t * sys)
+{
+  spnr_field_t const * const field = &sys->field;
+  size_t i, j, c, count;
+  size_t const N = sys->graph->N, n = spnr_sys_n_comps (sys);
+  float * const buf = malloc_err (SPNR_CHUNK * n * sizeof (float));
+  float *s;
+  double h = 0;
+  
+  for (i = 0; i < N; i += SPNR_CHUNK)
+    {
+      count = (N - i < SPNR_CHUNK) ? N - i : SPNR_CHUNK;
+      sys->kind->get_comps (sys->priv, buf, i, count);
+      for (j = 0; j < count; ++j)
+        {
+          s = buf + j * n;
+          for (c = 0; c < n; ++c)
+            {
+              if (field->uniform)
+                h -= field->uniform[c] * s[c];
+              if (field->site)
+                h -= field->site[(i + j) * n + c] * s[c];
+            }
+          h -= field->aniso * s[0] * s[0];
+        }
+    }
+  
+  free_err (buf);
+  
+  return h / N;
+}
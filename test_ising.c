@@ -0,0 +1,1033 @@
+/* test_ising.c
+ * 
+ * Copyright (C) 2024 L. Bertini
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/* Statistical correctness test, run by `make check`
+ *
+ * Samples the 2D Ising model with every stepper and compares the
+ * results with exact values:
+ *   - exact enumeration of all 2^N configurations of small lattices
+ *     (4x4 cubic and power-law graphs, 3x3 triangular, 2x3x3
+ *     honeycomb), energy and magnetization;
+ *   - the exact partition function of the 4x4 lattice, for population
+ *     annealing;
+ *   - Kaufman's exact partition function of the periodic LxL lattice,
+ *     energy at L = 16, and at L = 64 against the temperature measured
+ *     by the demons of a microcanonical run;
+ *   - the exact energy of long XY and Heisenberg chains, for the
+ *     batched path taken by continuous spins.
+ * Specific heats of the 4x4 lattice also check the jackknife and
+ * bootstrap errors, and the jackknife error of the mean energy must
+ * equal the plain binning error. The observables of spnr_sys_calc_obs
+ * must match direct sums on a cubic lattice, and the nearest neighbour
+ * correlation must match the energy on stencil lattices; G(r) of
+ * spnr_corr_calc_g must match direct sums too. Saved and mapped graphs
+ * must give back the energy of the graph they were saved from, and
+ * snapshots the packed configurations they were written from.
+ * Pipelined probing must record the traces of synchronous probing, and
+ * the n-fold way must follow fields changed between its applies.
+ * Monte Carlo estimates pass when they lie within SIGMA_MAX error bars
+ * of the exact value, the error bar being estimated by binning the time
+ * series in N_BLOCKS blocks. Wang-Landau estimates are deterministic
+ * functions of g(e) and, like the population annealing ones, are
+ * checked against a relative tolerance. All runs use fixed seeds, so
+ * the outcome is reproducible. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "spinner.h"
+
+#define SIGMA_MAX 4.0
+#define N_BLOCKS 32
+#define WL_TOL 0.01
+#define PA_TOL 0.01
+#define WORM_TOL 0.01
+#define DEMON_TOL 0.01
+#define SEED 20240601
+#define PI 3.14159265358979323846
+
+static int n_fail = 0;
+
+/* exact canonical averages from an enumerated spectrum */
+typedef struct
+{
+  double e;
+  double c;
+  double abs_m;
+} exact_t;
+
+/* Energies per site and magnetizations of all 2^N configurations,
+ * visited in Gray code order: each configuration differs from the
+ * previous one by a single spin flip, done through the kind vtable */
+static void
+enumerate (spnr_sys_t * const sys, double * const e, double * const m)
+{
+  size_t const N = sys->graph->N;
+  size_t const n_conf = (size_t) 1 << N;
+  size_t c, k;
+  void * const prop = malloc (spnr_sys_spin_size (sys));
+
+  for (c = 0; c < n_conf; ++c)
+    {
+      if (c > 0)
+        {
+          for (k = 0; !((c >> k) & 1); ++k)
+            ;
+          sys->kind->fill_prop (sys->priv, prop, k);
+          sys->kind->accept_prop (sys->priv, prop, k);
+        }
+      e[c] = spnr_sys_calc_h (sys);
+      m[c] = spnr_sys_calc_phi (sys);
+    }
+
+  free (prop);
+}
+
+static exact_t
+exact_avg (double const * const e, double const * const m,
+           size_t const n_conf, size_t const N, double const temp)
+{
+  size_t c;
+  double w, e_min = e[0], z = 0, se = 0, se2 = 0, sm = 0;
+  exact_t res;
+
+  for (c = 1; c < n_conf; ++c)
+    if (e[c] < e_min)
+      e_min = e[c];
+
+  for (c = 0; c < n_conf; ++c)
+    {
+      w = exp (- (double) N * (e[c] - e_min) / temp);
+      z += w;
+      se += w * e[c];
+      se2 += w * e[c] * e[c];
+      sm += w * fabs (m[c]);
+    }
+
+  res.e = se / z;
+  res.c = N * (se2 / z - res.e * res.e) / (temp * temp);
+  res.abs_m = sm / z;
+  return res;
+}
+
+/* log of the partition function of the periodic LxL Ising model at
+ * coupling K = J / T (Kaufman 1949) */
+static double
+kaufman_ln_z (size_t const L, double const K)
+{
+  size_t r, i;
+  double gamma, c, ln_z[4], sign[4], max, sum;
+  double const N = (double) L * L;
+
+  for (i = 0; i < 4; ++i)
+    {
+      ln_z[i] = 0;
+      sign[i] = 1;
+    }
+
+  for (r = 0; r < L; ++r)
+    {
+      /* odd gammas enter z1, z2, even ones z3, z4 */
+      for (i = 0; i < 2; ++i)
+        {
+          size_t const k = 2 * r + 1 - i;
+          if (k == 0)
+            gamma = 2 * K + log (tanh (K));
+          else
+            {
+              c = cosh (2 * K) / tanh (2 * K) - cos (PI * k / L);
+              gamma = acosh (c);
+            }
+          ln_z[2 * i] += log (2 * cosh (L * gamma / 2));
+          ln_z[2 * i + 1] += log (2 * fabs (sinh (L * gamma / 2)));
+          if (gamma < 0)
+            sign[2 * i + 1] = -sign[2 * i + 1];
+        }
+    }
+
+  max = ln_z[0];
+  for (i = 1; i < 4; ++i)
+    if (ln_z[i] > max)
+      max = ln_z[i];
+  for (i = 0, sum = 0; i < 4; ++i)
+    sum += sign[i] * exp (ln_z[i] - max);
+
+  return N / 2 * log (2 * sinh (2 * K)) - log (2) + max + log (sum);
+}
+
+/* energy per site as - d ln Z / d K / N, by central differences */
+static double
+kaufman_e (size_t const L, double const temp)
+{
+  double const K = 1 / temp, dK = 1e-5;
+
+  return - (kaufman_ln_z (L, K + dK) - kaufman_ln_z (L, K - dK))
+    / (2 * dK) / (L * L);
+}
+
+/* mean and binned error bar of a time series */
+static void
+block_mean (float const * const x, size_t const n, int const abs_val,
+            double * const mean, double * const err)
+{
+  size_t b, i;
+  size_t const len = n / N_BLOCKS;
+  double bm, s = 0, s2 = 0;
+
+  for (b = 0; b < N_BLOCKS; ++b)
+    {
+      bm = 0;
+      for (i = b * len; i < (b + 1) * len; ++i)
+        bm += abs_val ? fabs (x[i]) : x[i];
+      bm /= len;
+      s += bm;
+      s2 += bm * bm;
+    }
+
+  *mean = s / N_BLOCKS;
+  *err = sqrt ((s2 / N_BLOCKS - *mean * *mean) / (N_BLOCKS - 1));
+}
+
+static void
+check_sigma (char const * const what, double const temp, double const mean,
+             double const err, double const exact)
+{
+  double const dev = fabs (mean - exact) / (err + 1e-6);
+  int const ok = dev < SIGMA_MAX;
+
+  printf ("%-4s %-32s T = %.3f  %+.5f +- %.5f  exact %+.5f  (%.1f sigma)\n",
+          ok ? "ok" : "FAIL", what, temp, mean, err, exact, dev);
+  if (!ok)
+    ++n_fail;
+}
+
+static void
+check_rel (char const * const what, double const temp, double const val,
+           double const exact, double const tol)
+{
+  double const dev = fabs (val - exact) / fabs (exact);
+  int const ok = dev < tol;
+
+  printf ("%-4s %-32s T = %.3f  %+.5f  exact %+.5f  (%.2f%%)\n",
+          ok ? "ok" : "FAIL", what, temp, val, exact, 100 * dev);
+  if (!ok)
+    ++n_fail;
+}
+
+/* equilibrates, samples n_probes sweeps and returns the estimates of
+ * the energy per site and of |m| */
+static void
+sample (spnr_sys_t * const sys, spnr_step_kind_t const * const kind,
+        double const temp, size_t const n_probes, double * const e,
+        double * const e_err, double * const m, double * const m_err)
+{
+  spnr_step_t * const step = spnr_step_alloc (kind, spnr_sys_spin_size (sys));
+  spnr_data_t * const data = spnr_data_alloc (n_probes);
+  size_t i;
+
+  spnr_rng_seed (SEED);
+  for (i = 0; i < n_probes / 10; ++i)
+    spnr_step_apply (step, sys, 1 / temp);
+  spnr_data_run_and_probe (data, sys, step, temp, 1);
+  block_mean (data->h, n_probes, SPNR_FALSE, e, e_err);
+  block_mean (data->phi, n_probes, SPNR_TRUE, m, m_err);
+
+  spnr_data_free (data);
+  spnr_step_free (step);
+}
+
+static void
+test_enum (spnr_graph_kind_t const * const graph_kind,
+           spnr_step_kind_t const * const step_kind, size_t const N,
+           double const * const temps, size_t const n_temps)
+{
+  size_t const n_conf = (size_t) 1 << N;
+  spnr_graph_t * const graph = spnr_graph_alloc (graph_kind, spnr_ferr, N, 2);
+  spnr_sys_t * const sys = spnr_sys_alloc (graph, spnr_ising, 0);
+  double * const e = malloc (n_conf * sizeof (double));
+  double * const m = malloc (n_conf * sizeof (double));
+  double e_mc, e_err, m_mc, m_err;
+  char what[64];
+  exact_t ex;
+  size_t t;
+
+  enumerate (sys, e, m);
+  for (t = 0; t < n_temps; ++t)
+    {
+      ex = exact_avg (e, m, n_conf, N, temps[t]);
+      sample (sys, step_kind, temps[t], 200000, &e_mc, &e_err, &m_mc,
+              &m_err);
+      snprintf (what, sizeof (what), "%s/%s e", graph_kind->name,
+                step_kind->name);
+      check_sigma (what, temps[t], e_mc, e_err, ex.e);
+      snprintf (what, sizeof (what), "%s/%s |m|", graph_kind->name,
+                step_kind->name);
+      check_sigma (what, temps[t], m_mc, m_err, ex.abs_m);
+    }
+
+  free (e);
+  free (m);
+  spnr_sys_free (sys);
+  spnr_graph_free (graph);
+}
+
+/* Wang-Landau g(e), both directly and through a multicanonical run */
+static void
+test_wanglandau (double const * const temps, size_t const n_temps)
+{
+  size_t const L = 4, N = L * L, n_conf = (size_t) 1 << N, n_bins = N + 1;
+  double const e_min = -2 - 2.0 / N, e_max = 2 + 2.0 / N;
+  spnr_graph_t * const graph = spnr_graph_alloc (spnr_cubic, spnr_ferr, N, 2);
+  spnr_sys_t * const sys = spnr_sys_alloc (graph, spnr_ising, 0);
+  spnr_step_t * const step = spnr_step_alloc (spnr_wanglandau, 1);
+  spnr_data_t * const data = spnr_data_alloc (200000);
+  spnr_scan_t * const out = spnr_scan_alloc (n_temps);
+  double * const e = malloc (n_conf * sizeof (double));
+  double * const m = malloc (n_conf * sizeof (double));
+  double ln_g[N + 1];
+  exact_t ex;
+  size_t t;
+
+  enumerate (sys, e, m);
+  spnr_rng_seed (SEED);
+  spnr_wl_set_range (step, e_min, e_max, n_bins);
+  while (spnr_wl_ln_f (step) > 1e-6)
+    spnr_step_apply (step, sys, 0);
+  spnr_wl_get_ln_g (step, ln_g);
+
+  for (t = 0; t < n_temps; ++t)
+    out->x[t] = temps[t];
+  spnr_wl_thermo (out, ln_g, e_min, e_max, n_bins, N);
+  for (t = 0; t < n_temps; ++t)
+    {
+      ex = exact_avg (e, m, n_conf, N, temps[t]);
+      check_rel ("cubic/wanglandau e", temps[t], out->h_mean[t], ex.e,
+                 WL_TOL);
+      check_rel ("cubic/wanglandau c", temps[t], out->c[t], ex.c, WL_TOL);
+    }
+
+  spnr_wl_set_muca (step, SPNR_TRUE);
+  spnr_data_run_and_probe (data, sys, step, 1, 1);
+  spnr_wl_muca_reweight (out, step, data, N);
+  for (t = 0; t < n_temps; ++t)
+    {
+      ex = exact_avg (e, m, n_conf, N, temps[t]);
+      check_rel ("cubic/multicanonical e", temps[t], out->h_mean[t], ex.e,
+                 WL_TOL);
+      check_rel ("cubic/multicanonical |m|", temps[t], out->phi_mean[t],
+                 ex.abs_m, WL_TOL);
+    }
+
+  free (e);
+  free (m);
+  spnr_scan_free (out);
+  spnr_data_free (data);
+  spnr_step_free (step);
+  spnr_sys_free (sys);
+  spnr_graph_free (graph);
+}
+
+/* population annealing from T = 5 to 1.5, linear in beta, against the
+ * exact averages and partition function */
+static void
+test_anneal (void)
+{
+  size_t const L = 4, N = L * L, n_conf = (size_t) 1 << N, n_t = 31;
+  spnr_graph_t * const graph = spnr_graph_alloc (spnr_cubic, spnr_ferr, N, 2);
+  spnr_sys_t * const sys = spnr_sys_alloc (graph, spnr_ising, 0);
+  spnr_scan_t * const out = spnr_scan_alloc (n_t);
+  double * const e = malloc (n_conf * sizeof (double));
+  double * const m = malloc (n_conf * sizeof (double));
+  double ln_z[n_t], ln_z_ex[n_t], z;
+  exact_t ex;
+  size_t t, c;
+
+  enumerate (sys, e, m);
+  for (t = 0; t < n_t; ++t)
+    {
+      out->x[t] = 1 / (0.2 + t * (1 / 1.5 - 0.2) / (n_t - 1));
+      for (c = 0, z = 0; c < n_conf; ++c)
+        z += exp (- (double) N * e[c] / out->x[t]);
+      ln_z_ex[t] = log (z);
+    }
+  spnr_pa_run (out, ln_z, NULL, sys, spnr_metropolis, 10000, 5, SEED);
+
+  for (t = 10; t < n_t; t += 10)
+    {
+      ex = exact_avg (e, m, n_conf, N, out->x[t]);
+      check_rel ("cubic/anneal e", out->x[t], out->h_mean[t], ex.e, PA_TOL);
+      check_rel ("cubic/anneal |m|", out->x[t], out->phi_mean[t], ex.abs_m,
+                 PA_TOL);
+      check_rel ("cubic/anneal ln Z", out->x[t], ln_z[t],
+                 ln_z_ex[t] - ln_z_ex[0], PA_TOL);
+    }
+
+  free (e);
+  free (m);
+  spnr_scan_free (out);
+  spnr_sys_free (sys);
+  spnr_graph_free (graph);
+}
+
+/* a field switched on between applies of the same n-fold stepper must
+ * drive the spins like Metropolis does: first a uniform field against
+ * the ordered state, then a site field that overturns it */
+static void
+test_nfold_field (void)
+{
+  size_t const N = 1024, n_sweeps = 5;
+  spnr_step_kind_t const * const *steps[] = { &spnr_nfold, &spnr_metropolis };
+  spnr_graph_t * const graph = spnr_graph_alloc (spnr_cubic, spnr_ferr, N, 2);
+  float * const h_site = malloc (N * sizeof (float));
+  float const h = -5;
+  float m[2][2];
+  size_t i, t, phase;
+
+  for (i = 0; i < N; ++i)
+    h_site[i] = 10;
+
+  for (t = 0; t < 2; ++t)
+    {
+      spnr_sys_t * const sys = spnr_sys_alloc (graph, spnr_ising, 0);
+      spnr_step_t * const step = spnr_step_alloc (*steps[t],
+                                                  spnr_sys_spin_size (sys));
+
+      spnr_rng_seed (SEED);
+      sys->kind->set_up (sys->priv, N);
+      for (i = 0; i < n_sweeps; ++i)
+        spnr_step_apply (step, sys, 1.0);
+      for (phase = 0; phase < 2; ++phase)
+        {
+          if (phase)
+            spnr_sys_set_site_field (sys, h_site);
+          else
+            spnr_sys_set_field (sys, &h);
+          for (i = 0; i < n_sweeps; ++i)
+            spnr_step_apply (step, sys, 1.0);
+          spnr_sys_calc_magn (sys, &m[t][phase]);
+        }
+
+      spnr_step_free (step);
+      spnr_sys_free (sys);
+    }
+
+  check_rel ("nfold m after uniform field -5", 1, m[0][0], m[1][0], 0.05);
+  check_rel ("nfold m after site field +10", 1, m[0][1], m[1][1], 0.05);
+
+  free (h_site);
+  spnr_graph_free (graph);
+}
+
+/* worm estimators of the energy and of chi = N <m^2>, against exact
+ * enumeration */
+static void
+test_worm (double const * const temps, size_t const n_temps)
+{
+  size_t const L = 4, N = L * L, n_conf = (size_t) 1 << N;
+  spnr_graph_t * const graph = spnr_graph_alloc (spnr_cubic, spnr_ferr, N, 2);
+  spnr_sys_t * const sys = spnr_sys_alloc (graph, spnr_ising, 0);
+  spnr_step_t * const step = spnr_step_alloc (spnr_worm, 1);
+  double * const e = malloc (n_conf * sizeof (double));
+  double * const m = malloc (n_conf * sizeof (double));
+  double w, z, sm2, e_min;
+  size_t t, c, i;
+
+  enumerate (sys, e, m);
+  for (c = 1, e_min = e[0]; c < n_conf; ++c)
+    if (e[c] < e_min)
+      e_min = e[c];
+
+  spnr_rng_seed (SEED);
+  for (t = 0; t < n_temps; ++t)
+    {
+      for (c = 0, z = 0, sm2 = 0; c < n_conf; ++c)
+        {
+          w = exp (- (double) N * (e[c] - e_min) / temps[t]);
+          z += w;
+          sm2 += w * m[c] * m[c];
+        }
+
+      for (i = 0; i < 20000; ++i)
+        spnr_step_apply (step, sys, 1 / temps[t]);
+      spnr_worm_reset (step);
+      for (i = 0; i < 200000; ++i)
+        spnr_step_apply (step, sys, 1 / temps[t]);
+
+      check_rel ("cubic/worm e (estimator)", temps[t],
+                 spnr_worm_energy (step),
+                 exact_avg (e, m, n_conf, N, temps[t]).e, WORM_TOL);
+      check_rel ("cubic/worm chi (estimator)", temps[t], spnr_worm_chi (step),
+                 N * sm2 / z, WORM_TOL);
+    }
+
+  free (e);
+  free (m);
+  spnr_step_free (step);
+  spnr_sys_free (sys);
+  spnr_graph_free (graph);
+}
+
+static void
+test_resample (double const * const temps, size_t const n_temps)
+{
+  size_t const L = 4, N = L * L, n_conf = (size_t) 1 << N;
+  spnr_graph_t * const graph = spnr_graph_alloc (spnr_cubic, spnr_ferr, N, 2);
+  spnr_sys_t * const sys = spnr_sys_alloc (graph, spnr_ising, 0);
+  spnr_step_t * const step = spnr_step_alloc (spnr_metropolis, 1);
+  spnr_data_t * const data = spnr_data_alloc (200000);
+  spnr_data_t const * const series[1] = { data };
+  spnr_estimator_t const f[3] = { spnr_est_e, spnr_est_m, spnr_est_c };
+  double * const e = malloc (n_conf * sizeof (double));
+  double * const m = malloc (n_conf * sizeof (double));
+  double est[3], err[3], e_mc, e_err;
+  spnr_est_args_t args;
+  exact_t ex;
+  size_t t, i;
+
+  enumerate (sys, e, m);
+  for (t = 0; t < n_temps; ++t)
+    {
+      ex = exact_avg (e, m, n_conf, N, temps[t]);
+      args.beta = 1 / temps[t];
+      args.N = N;
+
+      spnr_rng_seed (SEED);
+      for (i = 0; i < data->size / 10; ++i)
+        spnr_step_apply (step, sys, 1 / temps[t]);
+      spnr_data_run_and_probe (data, sys, step, temps[t], 1);
+      block_mean (data->h, data->size, SPNR_FALSE, &e_mc, &e_err);
+
+      spnr_jackknife (est, err, series, 1, N_BLOCKS, f, 3, &args);
+      check_rel ("jackknife e error (binning)", temps[t], err[0], e_err,
+                 1e-6);
+      check_sigma ("cubic/jackknife c", temps[t], est[2], err[2], ex.c);
+
+      spnr_bootstrap (est, err, series, 1, N_BLOCKS, f, 3, &args, 200, SEED);
+      check_sigma ("cubic/bootstrap c", temps[t], est[2], err[2], ex.c);
+    }
+
+  free (e);
+  free (m);
+  spnr_data_free (data);
+  spnr_step_free (step);
+  spnr_sys_free (sys);
+  spnr_graph_free (graph);
+}
+
+/* modified Bessel function of the first kind, from its series */
+static double
+bessel_i (unsigned const nu, double const x)
+{
+  double term = 1, sum = 0;
+  unsigned k;
+
+  for (k = 1; k <= nu; ++k)
+    term *= x / (2 * k);
+  for (k = 0; term > 1e-17 * sum; ++k)
+    {
+      sum += term;
+      term *= x * x / (4 * (k + 1) * (k + 1 + nu));
+    }
+  return sum;
+}
+
+/* energy per bond of the open n-vector chain, which the periodic one
+ * of N sites approaches exponentially in N */
+static double
+chain_e (size_t const n, double const temp)
+{
+  double const K = 1 / temp;
+
+  if (n == 2)
+    return - bessel_i (1, K) / bessel_i (0, K);
+  return - (1 / tanh (K) - 1 / K);
+}
+
+static void
+test_chain (spnr_step_kind_t const * const step_kind,
+            double const * const temps, size_t const n_temps)
+{
+  size_t const N = 256;
+  spnr_graph_t * const graph = spnr_graph_alloc (spnr_cubic, spnr_ferr, N, 1);
+  double e_mc, e_err, m_mc, m_err;
+  char what[64];
+  size_t n, t;
+
+  for (n = 2; n <= 3; ++n)
+    {
+      spnr_sys_t * const sys = spnr_sys_alloc (graph, spnr_nvector, n);
+
+      snprintf (what, sizeof (what), "chain/%s e (n = %zu)", step_kind->name,
+                n);
+      for (t = 0; t < n_temps; ++t)
+        {
+          sample (sys, step_kind, temps[t], 20000, &e_mc, &e_err, &m_mc,
+                  &m_err);
+          check_sigma (what, temps[t], e_mc, e_err, chain_e (n, temps[t]));
+        }
+      spnr_sys_free (sys);
+    }
+
+  spnr_graph_free (graph);
+}
+
+static void
+test_kaufman (size_t const L, double const * const temps,
+              size_t const n_temps)
+{
+  size_t const N = L * L;
+  spnr_graph_t * const graph = spnr_graph_alloc (spnr_cubic, spnr_ferr, N, 2);
+  spnr_sys_t * const sys = spnr_sys_alloc (graph, spnr_ising, 0);
+  double e_mc, e_err, m_mc, m_err;
+  size_t t;
+
+  for (t = 0; t < n_temps; ++t)
+    {
+      sample (sys, spnr_metropolis, temps[t], 40000, &e_mc, &e_err, &m_mc,
+              &m_err);
+      check_sigma ("cubic/metropolis e (Kaufman)", temps[t], e_mc, e_err,
+                   kaufman_e (L, temps[t]));
+    }
+
+  spnr_sys_free (sys);
+  spnr_graph_free (graph);
+}
+
+/* microcanonical run from a configuration equilibrated at each
+ * temperature: the total energy is conserved and the mean energy
+ * agrees with Kaufman's at the temperature of the demons, within
+ * the difference between the ensembles */
+static void
+test_demon (size_t const L, double const * const temps, size_t const n_temps)
+{
+  size_t const N = L * L;
+  spnr_graph_t * const graph = spnr_graph_alloc (spnr_cubic, spnr_ferr, N, 2);
+  spnr_sys_t * const sys = spnr_sys_alloc (graph, spnr_ising, 0);
+  spnr_step_t * const metr = spnr_step_alloc (spnr_metropolis, 1);
+  spnr_step_t * const step = spnr_step_alloc (spnr_demon, 1);
+  spnr_data_t * const data = spnr_data_alloc (20000);
+  double e_tot, e_mc, e_err, temp;
+  size_t t, i;
+
+  spnr_rng_seed (SEED);
+  for (t = 0; t < n_temps; ++t)
+    {
+      for (i = 0; i < 2000; ++i)
+        spnr_step_apply (metr, sys, 1 / temps[t]);
+      spnr_demon_set_energy (step, 0);
+      e_tot = N * spnr_sys_calc_h (sys);
+
+      for (i = 0; i < 2000; ++i)
+        spnr_step_apply (step, sys, 0);
+      spnr_demon_reset (step);
+      spnr_data_run_and_probe (data, sys, step, 0, 1);
+      block_mean (data->h, data->size, SPNR_FALSE, &e_mc, &e_err);
+      temp = spnr_demon_temp (step, 4);
+
+      check_rel ("cubic/demon total energy", temps[t],
+                 N * spnr_sys_calc_h (sys) + spnr_demon_energy (step), e_tot,
+                 1e-6);
+      check_rel ("cubic/demon e (Kaufman at T_d)", temp, e_mc,
+                 kaufman_e (L, temp), DEMON_TOL);
+    }
+
+  spnr_data_free (data);
+  spnr_step_free (step);
+  spnr_step_free (metr);
+  spnr_sys_free (sys);
+  spnr_graph_free (graph);
+}
+
+/* the bulk observables of a random Heisenberg configuration on a 4x4x4
+ * cubic lattice must match direct sums over its sites */
+static void
+test_obs_cubic (void)
+{
+  size_t const L = 4, D = 3, N = L * L * L, n = 3;
+  spnr_graph_t * const graph = spnr_graph_alloc (spnr_cubic, spnr_ferr, N, D);
+  spnr_sys_t * const sys = spnr_sys_alloc (graph, spnr_nvector, n);
+  float * const s = malloc (N * n * sizeof (float));
+  double m[3] = { 0 }, stag[3] = { 0 }, nn = 0, s_k = 0, re, im, sum;
+  size_t i, j, c, d, unit;
+  int sign;
+  spnr_obs_t obs;
+
+  spnr_rng_seed (SEED);
+  sys->kind->set_rand (sys->priv, N);
+  sys->kind->get_comps (sys->priv, s, 0, N);
+  spnr_sys_calc_obs (sys, &obs);
+
+  for (i = 0; i < N; ++i)
+    {
+      sign = ((i % L + i / L % L + i / (L * L)) % 2) ? -1 : 1;
+      for (c = 0; c < n; ++c)
+        {
+          m[c] += s[i * n + c];
+          stag[c] += sign * s[i * n + c];
+        }
+      for (d = 0, unit = 1; d < D; ++d, unit *= L)
+        {
+          j = (i / unit % L + 1 < L) ? i + unit : i + unit - L * unit;
+          for (c = 0; c < n; ++c)
+            nn += s[i * n + c] * s[j * n + c];
+        }
+    }
+  for (d = 0, unit = 1; d < D; ++d, unit *= L)
+    for (c = 0; c < n; ++c)
+      {
+        for (i = 0, re = 0, im = 0; i < N; ++i)
+          {
+            re += s[i * n + c] * cos (2 * PI * (i / unit % L) / L);
+            im -= s[i * n + c] * sin (2 * PI * (i / unit % L) / L);
+          }
+        s_k += re * re + im * im;
+      }
+
+  for (c = 0, sum = 0; c < n; ++c)
+    {
+      check_rel ("obs cubic m", 0, obs.m[c], m[c] / N, 1e-5);
+      sum += stag[c] * stag[c];
+    }
+  check_rel ("obs cubic m_stag", 0, obs.m_stag, sqrt (sum) / N, 1e-5);
+  check_rel ("obs cubic nn_corr", 0, obs.nn_corr, nn / (N * D), 1e-5);
+  check_rel ("obs cubic s_kmin", 0, obs.s_kmin, s_k / (N * D), 1e-5);
+
+  free (s);
+  spnr_sys_free (sys);
+  spnr_graph_free (graph);
+}
+
+/* on random configurations of stencil lattices the nearest neighbour
+ * correlation covers every bond, -e = z / 2 nn_corr with unit
+ * couplings, and the staggered magnetization exists only on bipartite
+ * lattices */
+static void
+test_obs_stencil (void)
+{
+  struct
+  {
+    spnr_graph_kind_t const * const *kind;
+    size_t N, D, z;
+    int bipartite;
+  } const cases[] =
+  {
+    { &spnr_triangular, 36, 2, 6, SPNR_FALSE },
+    { &spnr_honeycomb, 72, 2, 3, SPNR_TRUE },
+    { &spnr_fcc, 64, 3, 12, SPNR_FALSE },
+    { &spnr_bcc, 64, 3, 8, SPNR_TRUE }
+  };
+  spnr_obs_t obs;
+  char what[64];
+  size_t t;
+
+  spnr_rng_seed (SEED);
+  for (t = 0; t < sizeof (cases) / sizeof (cases[0]); ++t)
+    {
+      spnr_graph_t * const graph = spnr_graph_alloc (*cases[t].kind,
+                                                     spnr_ferr, cases[t].N,
+                                                     cases[t].D);
+      spnr_sys_t * const sys = spnr_sys_alloc (graph, spnr_ising, 0);
+
+      sys->kind->set_rand (sys->priv, graph->N);
+      spnr_sys_calc_obs (sys, &obs);
+      snprintf (what, sizeof (what), "%s nn_corr (energy)",
+                graph->kind->name);
+      check_rel (what, 0, obs.nn_corr, -2 * obs.e / cases[t].z, 1e-5);
+      if (isnan (obs.m_stag) == cases[t].bipartite)
+        {
+          printf ("FAIL %s m_stag %s\n", graph->kind->name,
+                  cases[t].bipartite ? "missing" : "on a non-bipartite graph");
+          ++n_fail;
+        }
+
+      spnr_sys_free (sys);
+      spnr_graph_free (graph);
+    }
+}
+
+/* on Ising configurations G(0) = 1, and G(1) along the first axis must
+ * match the direct average of s_x s_(x+1) over the sites and over
+ * samples a few sweeps apart at T = 3; L = 6 takes the plain DFT path
+ * and L = 8 the radix-2 one */
+static void
+test_corr (void)
+{
+  size_t const sides[] = { 6, 8 };
+  size_t t, k, i, j, L, N;
+  double *g, nn;
+  float *s;
+  char what[64];
+
+  spnr_rng_seed (SEED);
+  for (t = 0; t < sizeof (sides) / sizeof (sides[0]); ++t)
+    {
+      spnr_graph_t *graph;
+      spnr_sys_t *sys;
+      spnr_corr_t *corr;
+      spnr_step_t *step;
+
+      L = sides[t];
+      N = L * L;
+      graph = spnr_graph_alloc (spnr_cubic, spnr_ferr, N, 2);
+      sys = spnr_sys_alloc (graph, spnr_ising, 0);
+      corr = spnr_corr_alloc (graph);
+      step = spnr_step_alloc (spnr_metropolis, spnr_sys_spin_size (sys));
+      g = malloc (N * sizeof (double));
+      s = malloc (N * sizeof (float));
+
+      sys->kind->set_rand (sys->priv, N);
+      for (k = 0, nn = 0; k < 2; ++k)
+        {
+          for (i = 0; i < 4; ++i)
+            spnr_step_apply (step, sys, 1 / 3.0);
+          sys->kind->get_comps (sys->priv, s, 0, N);
+          spnr_corr_add (corr, sys);
+          for (i = 0; i < N; ++i)
+            {
+              j = (i % L + 1 < L) ? i + 1 : i + 1 - L;
+              nn += s[i] * s[j];
+            }
+        }
+      spnr_corr_calc_g (corr, g);
+
+      snprintf (what, sizeof (what), "corr L = %lu G(0)", L);
+      check_rel (what, 3, g[0], 1, 1e-9);
+      snprintf (what, sizeof (what), "corr L = %lu G(1)", L);
+      check_rel (what, 3, g[1], nn / (2 * N), 1e-9);
+
+      free (g);
+      free (s);
+      spnr_corr_free (corr);
+      spnr_step_free (step);
+      spnr_sys_free (sys);
+      spnr_graph_free (graph);
+    }
+}
+
+/* a graph with Gaussian couplings saved and mapped back must give the
+ * same energy to a copy of a random Heisenberg configuration */
+static void
+test_graph_map (void)
+{
+  spnr_graph_kind_t const * const *kinds[] = { &spnr_cubic, &spnr_fcc };
+  char const * const fname = "test-graph.tmp";
+  char what[64];
+  size_t t;
+
+  spnr_rng_seed (SEED);
+  for (t = 0; t < sizeof (kinds) / sizeof (kinds[0]); ++t)
+    {
+      spnr_graph_t * const graph = spnr_graph_alloc (*kinds[t], spnr_gauss,
+                                                     64, 3);
+      spnr_sys_t * const sys = spnr_sys_alloc (graph, spnr_nvector, 3);
+      spnr_graph_t *mapped;
+      spnr_sys_t *copy;
+
+      sys->kind->set_rand (sys->priv, graph->N);
+      spnr_graph_save (graph, fname);
+      mapped = spnr_graph_map (fname);
+      copy = spnr_sys_alloc (mapped, spnr_nvector, 3);
+      spnr_sys_copy (copy, sys);
+
+      snprintf (what, sizeof (what), "%s mapped energy", graph->kind->name);
+      check_rel (what, 0, spnr_sys_calc_h (copy), spnr_sys_calc_h (sys),
+                 1e-9);
+
+      spnr_sys_free (copy);
+      spnr_graph_free (mapped);
+      spnr_sys_free (sys);
+      spnr_graph_free (graph);
+    }
+  remove (fname);
+}
+
+/* snapshots written with deltas, run lengths and a short keyframe
+ * interval must read back, in any order, to the packed frames pushed */
+static void
+test_snap (void)
+{
+  size_t const N = 256, n_frames = 12;
+  size_t const order[] = { 7, 2, 11, 3, 3, 0, 8, 9, 5, 4, 1, 10, 6 };
+  char const * const fname = "test-snap.tmp";
+  spnr_graph_t * const graph = spnr_graph_alloc (spnr_cubic, spnr_ferr, N, 2);
+  spnr_sys_t * const sys = spnr_sys_alloc (graph, spnr_ising, 0);
+  spnr_sys_t * const back = spnr_sys_alloc (graph, spnr_ising, 0);
+  spnr_step_t * const step = spnr_step_alloc (spnr_metropolis,
+                                              spnr_sys_spin_size (sys));
+  size_t const size = sys->kind->pack_size (sys->priv, N);
+  unsigned char * const frames = malloc (n_frames * size);
+  unsigned char * const buf = malloc (size);
+  spnr_snap_writer_t *writer;
+  spnr_snap_reader_t *reader;
+  size_t i, k, n_bad = 0;
+
+  spnr_rng_seed (SEED);
+  sys->kind->set_rand (sys->priv, N);
+  writer = spnr_snap_writer_alloc (fname, sys,
+                                   SPNR_SNAP_DELTA | SPNR_SNAP_RLE, 4);
+  for (i = 0; i < n_frames; ++i)
+    {
+      spnr_step_apply (step, sys, 1 / 1.5);
+      sys->kind->pack (sys->priv, frames + i * size, N);
+      spnr_snap_writer_push (writer, sys);
+    }
+  spnr_snap_writer_free (writer);
+
+  reader = spnr_snap_reader_alloc (fname);
+  if (spnr_snap_reader_len (reader) != n_frames)
+    ++n_bad;
+  for (k = 0; k < sizeof (order) / sizeof (order[0]); ++k)
+    {
+      spnr_snap_reader_get (reader, order[k], back);
+      back->kind->pack (back->priv, buf, N);
+      if (memcmp (buf, frames + order[k] * size, size))
+        ++n_bad;
+    }
+  spnr_snap_reader_free (reader);
+
+  printf ("%-4s %-32s %lu frames, %lu mismatches\n", n_bad ? "FAIL" : "ok",
+          "snapshot round trip", n_frames, n_bad);
+  if (n_bad)
+    ++n_fail;
+
+  remove (fname);
+  free (frames);
+  free (buf);
+  spnr_step_free (step);
+  spnr_sys_free (back);
+  spnr_sys_free (sys);
+  spnr_graph_free (graph);
+}
+
+/* counts the probes seen by the hook of test_async */
+static void
+count_probe (spnr_sys_t * const snap, size_t const i, void * const ctx)
+{
+  (void) snap;
+  ++((size_t *) ctx)[i];
+}
+
+/* pipelined probing from the same seed and configuration must record
+ * the traces of spnr_data_run_and_probe, and call the hook once per
+ * probe */
+static void
+test_async (void)
+{
+  size_t const N = 256, n_probes = 64;
+  spnr_graph_t * const graph = spnr_graph_alloc (spnr_cubic, spnr_ferr, N, 2);
+  spnr_sys_t * const sys = spnr_sys_alloc (graph, spnr_ising, 0);
+  spnr_step_t * const step = spnr_step_alloc (spnr_metropolis,
+                                              spnr_sys_spin_size (sys));
+  spnr_data_t * const sync = spnr_data_alloc (n_probes);
+  spnr_data_t * const async = spnr_data_alloc (n_probes);
+  size_t * const seen = calloc (n_probes, sizeof (size_t));
+  size_t i, n_bad = 0;
+
+  spnr_rng_seed (SEED);
+  sys->kind->set_rand (sys->priv, N);
+  spnr_data_run_and_probe (sync, sys, step, 2.269, 2);
+
+  spnr_rng_seed (SEED);
+  sys->kind->set_rand (sys->priv, N);
+  spnr_data_run_and_probe_async (async, sys, step, 2.269, 2, 3, count_probe,
+                                 seen);
+
+  for (i = 0; i < n_probes; ++i)
+    if (async->h[i] != sync->h[i] || async->phi[i] != sync->phi[i]
+        || seen[i] != 1)
+      ++n_bad;
+  printf ("%-4s %-32s %lu probes, %lu mismatches\n", n_bad ? "FAIL" : "ok",
+          "async probing traces", n_probes, n_bad);
+  if (n_bad)
+    ++n_fail;
+
+  free (seen);
+  spnr_data_free (sync);
+  spnr_data_free (async);
+  spnr_step_free (step);
+  spnr_sys_free (sys);
+  spnr_graph_free (graph);
+}
+
+/* the Kaufman reference must agree with the enumeration of 4x4 */
+static void
+test_reference (double const * const temps, size_t const n_temps)
+{
+  size_t const L = 4, N = L * L, n_conf = (size_t) 1 << N;
+  spnr_graph_t * const graph = spnr_graph_alloc (spnr_cubic, spnr_ferr, N, 2);
+  spnr_sys_t * const sys = spnr_sys_alloc (graph, spnr_ising, 0);
+  double * const e = malloc (n_conf * sizeof (double));
+  double * const m = malloc (n_conf * sizeof (double));
+  size_t t;
+
+  enumerate (sys, e, m);
+  for (t = 0; t < n_temps; ++t)
+    check_rel ("reference Kaufman 4x4 e", temps[t], kaufman_e (L, temps[t]),
+               exact_avg (e, m, n_conf, N, temps[t]).e, 1e-5);
+
+  free (e);
+  free (m);
+  spnr_sys_free (sys);
+  spnr_graph_free (graph);
+}
+
+int
+main (void)
+{
+  double const temps[] = { 1.5, 2.269, 3.5 };
+  double const lr_temps[] = { 2.0, 5.0 };
+  double const tri_temps[] = { 2.5, 3.641, 5.0 };
+  double const demon_temps[] = { 3.5, 5.0 };
+  double const chain_temps[] = { 0.5, 2.0 };
+  size_t const n_temps = sizeof (temps) / sizeof (temps[0]);
+  size_t const n_lr_temps = sizeof (lr_temps) / sizeof (lr_temps[0]);
+  size_t const n_tri_temps = sizeof (tri_temps) / sizeof (tri_temps[0]);
+  size_t const n_demon_temps = sizeof (demon_temps) / sizeof (demon_temps[0]);
+  size_t const n_chain_temps = sizeof (chain_temps) / sizeof (chain_temps[0]);
+
+  test_reference (temps, n_temps);
+  test_obs_cubic ();
+  test_obs_stencil ();
+  test_corr ();
+  test_graph_map ();
+  test_snap ();
+  test_async ();
+  test_enum (spnr_cubic, spnr_metropolis, 16, temps, n_temps);
+  test_enum (spnr_cubic, spnr_nfold, 16, temps, n_temps);
+  test_enum (spnr_cubic, spnr_checkerboard, 16, temps, n_temps);
+  test_enum (spnr_cubic, spnr_worm, 16, temps, n_temps);
+  test_enum (spnr_triangular, spnr_checkerboard, 9, tri_temps, n_tri_temps);
+  test_enum (spnr_honeycomb, spnr_checkerboard, 18, temps, n_temps);
+  test_enum (spnr_powerlaw, spnr_metropolis, 16, lr_temps, n_lr_temps);
+  test_enum (spnr_powerlaw, spnr_lr_metropolis, 16, lr_temps, n_lr_temps);
+  test_wanglandau (temps, n_temps);
+  test_anneal ();
+  test_nfold_field ();
+  test_worm (temps, n_temps);
+  test_resample (temps, n_temps);
+  test_kaufman (16, temps, n_temps);
+  test_demon (64, demon_temps, n_demon_temps);
+  test_chain (spnr_metropolis, chain_temps, n_chain_temps);
+  test_chain (spnr_checkerboard, chain_temps, n_chain_temps);
+
+  printf ("%d failures\n", n_fail);
+  return n_fail ? EXIT_FAILURE : EXIT_SUCCESS;
+}
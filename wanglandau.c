@@ -0,0 +1,546 @@
+/* wanglandau.c
+ * 
+ * Copyright (C) 2024 L. Bertini
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "spinner.h"
+#include "error.h"
+#include "rng.h"
+#include "stats.h"
+
+#define SPNR_WL_FLAT 0.8
+
+/* Wang-Landau flat histogram stepper
+ *
+ * Estimates the logarithm of the density of states ln g(e) on n_bins
+ * bins of the energy per site in [e_min, e_max). Each apply makes N
+ * proposals accepted with probability g(e_old) / g(e_new), tracking the
+ * energy incrementally through calc_delta_h; ln g of the current bin
+ * is raised by ln_f after every proposal, and ln_f is halved whenever
+ * the histogram of the visited bins is flat. Once ln_f drops below
+ * n_visited / n_trials it follows that value instead (the 1/t variant
+ * of Belardinelli and Pereyra), which removes the saturation error of
+ * plain halving. The beta argument is ignored. In multicanonical mode
+ * ln g is frozen and only the histogram is collected, so that
+ * production runs sample with weights 1 / g(e) and can be reweighted
+ * to any temperature. */
+
+typedef struct
+{
+  void *prop;
+
+  double e_min;
+  double e_max;
+  size_t n_bins;
+  double *ln_g;
+  size_t *hist;
+  char *visited;
+
+  double ln_f;
+  double n_trials;
+  int one_over_t;
+  int muca;
+  float acc_rate;
+} wl_priv_t;
+
+static void *
+priv_alloc (size_t const spin_size)
+{
+  wl_priv_t * const priv = malloc_err (sizeof (wl_priv_t));
+
+  priv->prop = malloc_err (spin_size);
+  priv->n_bins = 0;
+  priv->ln_g = NULL;
+  priv->hist = NULL;
+  priv->visited = NULL;
+  priv->ln_f = 1;
+  priv->n_trials = 0;
+  priv->one_over_t = SPNR_FALSE;
+  priv->muca = SPNR_FALSE;
+  priv->acc_rate = NAN;
+
+  return priv;
+}
+
+static void
+priv_free (void * const priv)
+{
+  wl_priv_t * const priv_ = (wl_priv_t *) priv;
+
+  free_err (priv_->prop);
+  free_err (priv_->ln_g);
+  free_err (priv_->hist);
+  free_err (priv_->visited);
+  free_err (priv_);
+}
+
+static long
+wl_bin (wl_priv_t const * const priv, double const e)
+{
+  double const x = (e - priv->e_min) / (priv->e_max - priv->e_min);
+
+  if (x < 0 || x >= 1)
+    return -1;
+  return x * priv->n_bins;
+}
+
+/* distance in energy of e from the window, used to drive walkers that
+ * start outside of it */
+static double
+wl_dist (wl_priv_t const * const priv, double const e)
+{
+  if (e < priv->e_min)
+    return priv->e_min - e;
+  if (e >= priv->e_max)
+    return e - priv->e_max;
+  return 0;
+}
+
+static size_t
+wl_n_visited (wl_priv_t const * const priv)
+{
+  size_t b, n = 0;
+
+  for (b = 0; b < priv->n_bins; ++b)
+    n += priv->visited[b];
+
+  return n;
+}
+
+static int
+wl_hist_flat (wl_priv_t const * const priv)
+{
+  size_t b, n = 0, min = (size_t) -1;
+  double mean = 0;
+
+  for (b = 0; b < priv->n_bins; ++b)
+    if (priv->visited[b])
+      {
+        mean += priv->hist[b];
+        if (priv->hist[b] < min)
+          min = priv->hist[b];
+        ++n;
+      }
+
+  return n > 0 && min >= SPNR_WL_FLAT * mean / n;
+}
+
+static void
+apply (void * const priv, spnr_sys_t const * const sys, float const beta)
+{
+  wl_priv_t * const priv_ = (wl_priv_t *) priv;
+  spnr_graph_t const * const graph = sys->graph;
+  size_t i, k, n_acc = 0;
+  size_t const N = graph->N;
+  void * const prop = priv_->prop;
+  double e, e_new, delta_h, inv_t;
+  long b, b_new;
+  int acc;
+  SPNR_STATS_VAR (t);
+
+  (void) beta;
+  if (priv_->n_bins == 0)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "Wang-Landau energy range not set");
+
+  /* recomputed every sweep, so the system can be changed in between */
+  e = spnr_sys_calc_h ((spnr_sys_t *) sys);
+  b = wl_bin (priv_, e);
+
+  SPNR_STATS_TIC (t);
+  for (i = 0; i < N; ++i)
+    {
+      k = spnr_rng_int (N);
+      sys->kind->fill_prop (sys->priv, prop, k);
+      SPNR_STATS_LAP (t, SPNR_PHASE_PROP);
+      delta_h = graph->kind->calc_delta_h (graph->priv, sys, prop, k);
+      SPNR_STATS_LAP (t, SPNR_PHASE_DELTA_H);
+      e_new = e + delta_h / N;
+      b_new = wl_bin (priv_, e_new);
+
+      if (b < 0)
+        acc = wl_dist (priv_, e_new) <= wl_dist (priv_, e);
+      else if (b_new < 0)
+        acc = SPNR_FALSE;
+      else
+        acc = priv_->ln_g[b] >= priv_->ln_g[b_new]
+          || spnr_rng_unif () < exp (priv_->ln_g[b] - priv_->ln_g[b_new]);
+
+      if (acc)
+        {
+          sys->kind->accept_prop (sys->priv, prop, k);
+          ++n_acc;
+          e = e_new;
+          b = b_new;
+        }
+
+      if (b >= 0)
+        {
+          ++priv_->hist[b];
+          priv_->visited[b] = SPNR_TRUE;
+          if (!priv_->muca)
+            priv_->ln_g[b] += priv_->ln_f;
+        }
+      SPNR_STATS_LAP (t, SPNR_PHASE_ACCEPT);
+    }
+
+  if (!priv_->muca)
+    {
+      priv_->n_trials += N;
+      inv_t = wl_n_visited (priv_) / priv_->n_trials;
+
+      if (priv_->one_over_t || priv_->ln_f <= inv_t)
+        {
+          priv_->one_over_t = SPNR_TRUE;
+          priv_->ln_f = inv_t;
+        }
+      else if (wl_hist_flat (priv_))
+        {
+          priv_->ln_f /= 2;
+          memset (priv_->hist, 0, priv_->n_bins * sizeof (size_t));
+        }
+    }
+
+  priv_->acc_rate = (float) n_acc / N;
+  SPNR_STATS_ADD (n_prop, N);
+  SPNR_STATS_ADD (n_acc, n_acc);
+}
+
+static float
+acc_rate (void const * const priv)
+{
+  return ((wl_priv_t const *) priv)->acc_rate;
+}
+
+static const spnr_step_kind_t wanglandau_kind =
+{
+  "wanglandau",
+  &priv_alloc,
+  &priv_free,
+  &apply,
+  &acc_rate
+};
+
+const spnr_step_kind_t *spnr_wanglandau = &wanglandau_kind;
+
+static wl_priv_t *
+wl_priv (spnr_step_t const * const step)
+{
+  if (step->kind != spnr_wanglandau)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "stepper is not a Wang-Landau stepper");
+  return (wl_priv_t *) step->priv;
+}
+
+/* sets the energy per site window and resets the estimate */
+void
+spnr_wl_set_range (spnr_step_t * const step, double const e_min,
+                   double const e_max, size_t const n_bins)
+{
+  wl_priv_t * const priv = wl_priv (step);
+
+  if (n_bins == 0 || e_max <= e_min)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "invalid Wang-Landau energy range");
+
+  free_err (priv->ln_g);
+  free_err (priv->hist);
+  free_err (priv->visited);
+
+  priv->e_min = e_min;
+  priv->e_max = e_max;
+  priv->n_bins = n_bins;
+  priv->ln_g = malloc_err (n_bins * sizeof (double));
+  priv->hist = malloc_err (n_bins * sizeof (size_t));
+  priv->visited = malloc_err (n_bins);
+  memset (priv->ln_g, 0, n_bins * sizeof (double));
+  memset (priv->hist, 0, n_bins * sizeof (size_t));
+  memset (priv->visited, 0, n_bins);
+  priv->ln_f = 1;
+  priv->n_trials = 0;
+  priv->one_over_t = SPNR_FALSE;
+}
+
+/* freezes (muca = SPNR_TRUE) or unfreezes ln g, resetting the histogram */
+void
+spnr_wl_set_muca (spnr_step_t * const step, int const muca)
+{
+  wl_priv_t * const priv = wl_priv (step);
+
+  priv->muca = muca;
+  memset (priv->hist, 0, priv->n_bins * sizeof (size_t));
+}
+
+double
+spnr_wl_ln_f (spnr_step_t const * const step)
+{
+  return wl_priv (step)->ln_f;
+}
+
+/* copies ln g, normalized to zero in the lowest visited bin; bins
+ * never visited are set to -INFINITY */
+void
+spnr_wl_get_ln_g (spnr_step_t const * const step, double * const ln_g)
+{
+  wl_priv_t const * const priv = wl_priv (step);
+  size_t b;
+  double ref = NAN;
+
+  for (b = 0; b < priv->n_bins; ++b)
+    if (priv->visited[b])
+      {
+        if (isnan (ref))
+          ref = priv->ln_g[b];
+        ln_g[b] = priv->ln_g[b] - ref;
+      }
+    else
+      ln_g[b] = -INFINITY;
+}
+
+void
+spnr_wl_get_hist (spnr_step_t const * const step, size_t * const hist)
+{
+  wl_priv_t const * const priv = wl_priv (step);
+  memcpy (hist, priv->hist, priv->n_bins * sizeof (size_t));
+}
+
+/* Canonical averages of the energy from ln g (as returned by
+ * spnr_wl_get_ln_g) at the temperatures in out->x; magnetization
+ * columns are not available from g(e) and are set to NAN */
+void
+spnr_wl_thermo (spnr_scan_t * const out, double const * const ln_g,
+                double const e_min, double const e_max,
+                size_t const n_bins, size_t const N)
+{
+  size_t i, b;
+  double const de = (e_max - e_min) / n_bins;
+
+#pragma omp parallel for private (b)
+  for (i = 0; i < out->size; ++i)
+    {
+      double const beta = 1.0 / out->x[i];
+      double e, x, p, max = -INFINITY, z = 0, sum_e = 0, sum_e2 = 0;
+
+      for (b = 0; b < n_bins; ++b)
+        {
+          x = ln_g[b] - beta * N * (e_min + (b + 0.5) * de);
+          if (x > max)
+            max = x;
+        }
+      for (b = 0; b < n_bins; ++b)
+        {
+          if (isinf (ln_g[b]))
+            continue;
+          e = e_min + (b + 0.5) * de;
+          p = exp (ln_g[b] - beta * N * e - max);
+          z += p;
+          sum_e += p * e;
+          sum_e2 += p * e * e;
+        }
+
+      out->h_mean[i] = sum_e / z;
+      out->h_var[i] = sum_e2 / z - (sum_e / z) * (sum_e / z);
+      out->c[i] = beta * beta * N * out->h_var[i];
+      out->phi_mean[i] = NAN;
+      out->phi_var[i] = NAN;
+      out->chi[i] = NAN;
+      out->binder[i] = NAN;
+      out->n_equil[i] = 0;
+    }
+}
+
+/* Canonical averages at the temperatures in out->x from the probes of
+ * a multicanonical production run made with step */
+void
+spnr_wl_muca_reweight (spnr_scan_t * const out, spnr_step_t const * const step,
+                       spnr_data_t const * const data, size_t const N)
+{
+  wl_priv_t const * const priv = wl_priv (step);
+  size_t i, t;
+
+#pragma omp parallel for private (t)
+  for (i = 0; i < out->size; ++i)
+    {
+      double const beta = 1.0 / out->x[i];
+      double x, p, h, a, max = -INFINITY, z = 0;
+      double sum_h = 0, sum_h2 = 0, sum_m = 0, sum_m2 = 0, sum_m4 = 0;
+      long b;
+
+      for (t = 0; t < data->size; ++t)
+        {
+          b = wl_bin (priv, data->h[t]);
+          x = (b < 0) ? -INFINITY : priv->ln_g[b] - beta * N * data->h[t];
+          if (x > max)
+            max = x;
+        }
+      for (t = 0; t < data->size; ++t)
+        {
+          b = wl_bin (priv, data->h[t]);
+          if (b < 0)
+            continue;
+          p = exp (priv->ln_g[b] - beta * N * data->h[t] - max);
+          h = data->h[t];
+          a = fabs (data->phi[t]);
+          z += p;
+          sum_h += p * h;
+          sum_h2 += p * h * h;
+          sum_m += p * a;
+          sum_m2 += p * a * a;
+          sum_m4 += p * a * a * a * a;
+        }
+      sum_h /= z;
+      sum_h2 /= z;
+      sum_m /= z;
+      sum_m2 /= z;
+      sum_m4 /= z;
+
+      out->h_mean[i] = sum_h;
+      out->h_var[i] = sum_h2 - sum_h * sum_h;
+      out->phi_mean[i] = sum_m;
+      out->phi_var[i] = sum_m2 - sum_m * sum_m;
+      out->c[i] = beta * beta * N * out->h_var[i];
+      out->chi[i] = beta * N * out->phi_var[i];
+      out->binder[i] = 1 - sum_m4 / (3 * sum_m2 * sum_m2);
+      out->n_equil[i] = 0;
+    }
+}
+
+/* Parallel Wang-Landau over n_windows overlapping energy windows, one
+ * walker each, with replica exchange between neighboring windows
+ * every n_sweeps sweeps. Runs until ln_f < ln_f_final in every window,
+ * then joins the pieces into ln_g (n_bins values over [e_min, e_max))
+ * where the slopes of neighboring windows match best. */
+void
+spnr_wl_windows_run (double * const ln_g, spnr_sys_t const * const sys,
+                     double const e_min, double const e_max,
+                     size_t const n_bins, size_t const n_windows,
+                     double const overlap, double const ln_f_final,
+                     size_t const n_sweeps, unsigned long const seed)
+{
+  size_t w, b, round, best, lo, hi, width;
+  double const de = (e_max - e_min) / n_bins;
+  spnr_sys_t **systems;
+  spnr_step_t **steps;
+  size_t *first;
+  double *piece, *energy;
+  double shift, slope, diff, best_diff;
+  int done;
+
+  if (n_windows == 0 || overlap < 0 || overlap >= 1)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "invalid Wang-Landau windows");
+  width = n_bins / (n_windows - (n_windows - 1) * overlap);
+  if (width == 0)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "invalid Wang-Landau windows");
+
+  systems = malloc_err (n_windows * sizeof (spnr_sys_t *));
+  steps = malloc_err (n_windows * sizeof (spnr_step_t *));
+  first = malloc_err (n_windows * sizeof (size_t));
+  piece = malloc_err (n_bins * sizeof (double));
+  energy = malloc_err (n_windows * sizeof (double));
+
+  for (w = 0; w < n_windows; ++w)
+    {
+      first[w] = (w + 1 == n_windows) ? n_bins - width
+        : (size_t) (w * width * (1 - overlap));
+      systems[w] = spnr_sys_clone (sys);
+      steps[w] = spnr_step_alloc (spnr_wanglandau,
+                                  spnr_sys_spin_size (systems[w]));
+      spnr_wl_set_range (steps[w], e_min + first[w] * de,
+                         e_min + (first[w] + width) * de, width);
+    }
+
+  for (round = 0, done = SPNR_FALSE; !done; ++round)
+    {
+#pragma omp parallel for private (b)
+      for (w = 0; w < n_windows; ++w)
+        {
+          spnr_rng_seed (spnr_rng_hash (seed, round * n_windows + w));
+          for (b = 0; b < n_sweeps; ++b)
+            spnr_step_apply (steps[w], systems[w], 0);
+          energy[w] = spnr_sys_calc_h (systems[w]);
+        }
+
+      /* exchanges between pairs (w, w + 1), alternating even and odd w */
+      spnr_rng_seed (spnr_rng_hash (~seed, round));
+      for (w = round % 2; w + 1 < n_windows; w += 2)
+        {
+          wl_priv_t const * const p0 = (wl_priv_t *) steps[w]->priv;
+          wl_priv_t const * const p1 = (wl_priv_t *) steps[w + 1]->priv;
+          long const b00 = wl_bin (p0, energy[w]);
+          long const b01 = wl_bin (p0, energy[w + 1]);
+          long const b10 = wl_bin (p1, energy[w]);
+          long const b11 = wl_bin (p1, energy[w + 1]);
+          spnr_sys_t *tmp;
+
+          if (b00 < 0 || b01 < 0 || b10 < 0 || b11 < 0)
+            continue;
+          if (spnr_rng_unif () < exp (p0->ln_g[b00] - p0->ln_g[b01]
+                                      + p1->ln_g[b11] - p1->ln_g[b10]))
+            {
+              tmp = systems[w];
+              systems[w] = systems[w + 1];
+              systems[w + 1] = tmp;
+            }
+        }
+
+      done = SPNR_TRUE;
+      for (w = 0; w < n_windows; ++w)
+        if (spnr_wl_ln_f (steps[w]) >= ln_f_final)
+          done = SPNR_FALSE;
+    }
+
+  /* joins the windows */
+  spnr_wl_get_ln_g (steps[0], piece);
+  for (b = 0; b < n_bins; ++b)
+    ln_g[b] = (b < width) ? piece[b] : -INFINITY;
+
+  for (w = 1; w < n_windows; ++w)
+    {
+      spnr_wl_get_ln_g (steps[w], piece);
+      lo = first[w];
+      hi = first[w - 1] + width;
+      best = lo;
+      best_diff = INFINITY;
+      for (b = lo; b + 1 < hi; ++b)
+        {
+          slope = ln_g[b + 1] - ln_g[b];
+          diff = fabs (slope - (piece[b + 1 - lo] - piece[b - lo]));
+          if (isfinite (slope) && diff < best_diff)
+            {
+              best_diff = diff;
+              best = b;
+            }
+        }
+
+      shift = ln_g[best] - piece[best - lo];
+      if (!isfinite (shift))
+        shift = 0;
+      for (b = best; b < lo + width; ++b)
+        ln_g[b] = piece[b - lo] + shift;
+    }
+
+  for (w = 0; w < n_windows; ++w)
+    {
+      spnr_step_free (steps[w]);
+      spnr_sys_free (systems[w]);
+    }
+  free_err (systems);
+  free_err (steps);
+  free_err (first);
+  free_err (piece);
+  free_err (energy);
+}
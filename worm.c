@@ -0,0 +1,482 @@
+/* worm.c
+ * 
+ * Copyright (C) 2024 L. Bertini
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "spinner.h"
+#include "error.h"
+#include "internal.h"
+#include "rng.h"
+#include "stats.h"
+
+/* Worm algorithm (Prokof'ev and Svistunov)
+ *
+ * The high temperature expansion writes Z, up to a constant, as a sum
+ * over the bond occupations n_b = 0, 1 with an even number of occupied
+ * bonds at every site, of prod_b t_b^n_b, t_b = tanh (beta J_b). The
+ * worm adds two defects, ira and masha, where the number is odd: the
+ * sum over their positions gives Z sum_r G(r). Ira moves to a random
+ * neighbor, toggling the bond in between; adding the bond is accepted
+ * with probability t_b and removing it always. When ira meets masha
+ * the configuration is a closed graph of Z and both jump to a random
+ * site. Counting the distance between the defects after every update
+ * gives G(r), and chi = sum_r G(r) is the number of updates per
+ * visit of Z.
+ *
+ * At the end of an apply the worm is closed, and every empty bond is
+ * occupied with probability t_b: the clusters of the occupied bonds
+ * are then distributed like those of Fortuin and Kasteleyn, and a
+ * random sign per cluster gives an Ising configuration, which is
+ * written to the system. An apply runs until Z has been visited
+ * N times the fraction of the updates spent in Z so far, so that it
+ * costs about N updates: as the fraction converges, the configurations
+ * are sampled at fixed strides of the chain restricted to Z, which
+ * keeps them unbiased. Stopping at the first visit after N updates
+ * instead would favor the configurations that end long worms. */
+
+typedef struct
+{
+  spnr_sys_t const *sys;
+  float beta;
+  size_t N;
+  size_t L;
+  size_t D;
+  size_t unit[SPNR_DIMS_MAX + 1];
+
+  /* bond (k, d) joins k to its left neighbor along d, index k D + d */
+  uint64_t *occ;
+  float *t;
+  float *w;
+  double jt;
+  double s_w;
+
+  /* ira, its coordinates and its distance from masha */
+  size_t ira;
+  size_t x[SPNR_DIMS_MAX];
+  size_t dx[SPNR_DIMS_MAX];
+  size_t r;
+
+  /* updates and visits of Z since the last rebuild */
+  size_t n_all;
+  size_t n_all_z;
+
+  /* accumulators */
+  size_t *g;
+  size_t n_updates;
+  double e_sum;
+
+  size_t *parent;
+  unsigned char *buf;
+  float acc_rate;
+} worm_priv_t;
+
+static void *
+priv_alloc (size_t const spin_size)
+{
+  worm_priv_t * const priv = malloc_err (sizeof (worm_priv_t));
+  (void) spin_size;
+  priv->sys = NULL;
+  priv->beta = NAN;
+  priv->N = 0;
+  priv->occ = NULL;
+  priv->t = NULL;
+  priv->w = NULL;
+  priv->g = NULL;
+  priv->parent = NULL;
+  priv->buf = NULL;
+  priv->acc_rate = NAN;
+  return priv;
+}
+
+static void
+priv_free (void * const priv)
+{
+  worm_priv_t * const priv_ = (worm_priv_t *) priv;
+  free_err (priv_->occ);
+  free_err (priv_->t);
+  free_err (priv_->w);
+  free_err (priv_->g);
+  free_err (priv_->parent);
+  free_err (priv_->buf);
+  free_err (priv_);
+}
+
+static void
+obs_reset (worm_priv_t * const priv)
+{
+  memset (priv->g, 0, priv->N * sizeof (size_t));
+  priv->n_updates = 0;
+  priv->e_sum = 0;
+}
+
+/* a new system starts from the empty graph, a new beta from the last
+ * closed one */
+static void
+rebuild (worm_priv_t * const priv, spnr_sys_t const * const sys,
+         float const beta)
+{
+  spnr_graph_t const * const graph = sys->graph;
+  size_t const N = graph->N;
+  size_t k, d, D, L;
+  float J[2 * SPNR_DIMS_MAX];
+  double t;
+
+  D = graph->kind->dims (graph->priv, &L);
+  if (D > SPNR_DIMS_MAX)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "graph parameters out of bounds");
+
+  if (priv->sys != sys || priv->N != N)
+    {
+      free_err (priv->occ);
+      free_err (priv->t);
+      free_err (priv->w);
+      free_err (priv->g);
+      free_err (priv->parent);
+      free_err (priv->buf);
+      priv->occ = malloc_err ((N * D + 63) / 64 * sizeof (uint64_t));
+      priv->t = malloc_err (N * D * sizeof (float));
+      priv->w = malloc_err (N * D * sizeof (float));
+      priv->g = malloc_err (N * sizeof (size_t));
+      priv->parent = malloc_err (N * sizeof (size_t));
+      priv->buf = malloc_err ((N + 7) / 8);
+      memset (priv->occ, 0, (N * D + 63) / 64 * sizeof (uint64_t));
+
+      priv->N = N;
+      priv->L = L;
+      priv->D = D;
+      for (d = 0, priv->unit[0] = 1; d < D; ++d)
+        priv->unit[d + 1] = priv->unit[d] * L;
+      priv->ira = 0;
+      memset (priv->x, 0, sizeof (priv->x));
+      memset (priv->dx, 0, sizeof (priv->dx));
+      priv->r = 0;
+    }
+  priv->sys = sys;
+  priv->beta = beta;
+  priv->n_all = 0;
+  priv->n_all_z = 0;
+
+  /* w_b n_b, summed over the bonds, gives the energy (see
+   * spnr_worm_energy) */
+  priv->jt = 0;
+  priv->s_w = 0;
+  for (k = 0; k < N; ++k)
+    {
+      graph->kind->get_couplings (graph->priv, k, J);
+      for (d = 0; d < D; ++d)
+        {
+          if (J[d] < 0)
+            spnr_err (SPNR_ERROR_PARAM_OOB,
+                      "worm algorithm needs non-negative couplings");
+          t = tanh (beta * J[d]);
+          priv->t[k * D + d] = t;
+          priv->w[k * D + d] = t > 0 ? J[d] * (1 / t - t) : 0;
+          priv->jt += J[d] * t;
+          if ((priv->occ[(k * D + d) / 64] >> ((k * D + d) % 64)) & 1)
+            priv->s_w += priv->w[k * D + d];
+        }
+    }
+
+  obs_reset (priv);
+}
+
+static size_t
+find (size_t * const parent, size_t k)
+{
+  while (parent[k] != k)
+    k = parent[k] = parent[parent[k]];
+  return k;
+}
+
+/* occupies the empty bonds with probability t_b and writes a random
+ * spin per cluster; also sums w over the occupied bonds again, which
+ * discards the rounding of the updates */
+static void
+write_spins (worm_priv_t * const priv, spnr_sys_t const * const sys)
+{
+  size_t k, d, b, a, c, left;
+  size_t const N = priv->N, D = priv->D, L = priv->L;
+  size_t * const parent = priv->parent;
+  size_t x[SPNR_DIMS_MAX];
+  uint64_t u = 0;
+  int n_bits = 0;
+
+  for (k = 0; k < N; ++k)
+    parent[k] = k;
+
+  /* x runs over the coordinates of k; each draw serves two bonds */
+  priv->s_w = 0;
+  memset (x, 0, sizeof (x));
+  for (k = 0, b = 0; k < N; ++k)
+    {
+      for (d = 0; d < D; ++d, ++b)
+        {
+          if ((priv->occ[b / 64] >> (b % 64)) & 1)
+            priv->s_w += priv->w[b];
+          else
+            {
+              if (!n_bits)
+                {
+                  u = spnr_rng_next ();
+                  n_bits = 64;
+                }
+              n_bits -= 32;
+              if (!((u >> n_bits & 0xffffffff) * 0x1p-32 < priv->t[b]))
+                continue;
+            }
+
+          left = x[d] ? k - priv->unit[d] : k + (L - 1) * priv->unit[d];
+          a = find (parent, k);
+          c = find (parent, left);
+          if (a < c)
+            parent[c] = a;
+          else
+            parent[a] = c;
+        }
+      for (d = 0; d < D && ++x[d] == L; ++d)
+        x[d] = 0;
+    }
+
+  /* roots draw their sign first, the other sites copy it */
+  memset (priv->buf, 0, (N + 7) / 8);
+  for (k = 0; k < N; ++k)
+    if (parent[k] == k)
+      priv->buf[k / 8] |= (spnr_rng_next () >> 63) << (k % 8);
+  for (k = 0; k < N; ++k)
+    {
+      c = find (parent, k);
+      if (c != k)
+        priv->buf[k / 8] |= ((priv->buf[c / 8] >> (c % 8)) & 1) << (k % 8);
+    }
+
+  sys->kind->unpack (sys->priv, priv->buf, N);
+}
+
+static void
+apply (void * const priv, spnr_sys_t const * const sys, float const beta)
+{
+  worm_priv_t * const priv_ = (worm_priv_t *) priv;
+  spnr_graph_t const * const graph = sys->graph;
+  uint64_t *occ;
+  float const *tb, *w;
+  size_t *g;
+  size_t k, s, d, b, nbr, unit, L, D, N, ira, r;
+  size_t x[SPNR_DIMS_MAX], dx[SPNR_DIMS_MAX];
+  size_t n = 0, n_z = 0, n_acc = 0, n_worms;
+  double s_w, e_sum = 0;
+  uint64_t u;
+  SPNR_STATS_VAR (t);
+
+  if (sys->kind != spnr_ising)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "worm algorithm needs Ising spins");
+  if (graph->kind != spnr_cubic)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "worm algorithm needs a cubic graph");
+  if (sys->field.uniform || sys->field.site)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "worm algorithm needs zero field");
+
+  if (priv_->sys != sys || priv_->beta != beta || priv_->N != graph->N)
+    rebuild (priv_, sys, beta);
+  N = priv_->N;
+  L = priv_->L;
+  D = priv_->D;
+
+  /* visits of Z to wait for, 0 to do N updates on the first apply */
+  n_worms = 0;
+  if (priv_->n_all)
+    {
+      n_worms = (double) N * priv_->n_all_z / priv_->n_all + 0.5;
+      n_worms = n_worms ? n_worms : 1;
+    }
+
+  /* the state lives in locals during the loop, which the stores to the
+   * histogram cannot alias */
+  occ = priv_->occ;
+  tb = priv_->t;
+  w = priv_->w;
+  g = priv_->g;
+  ira = priv_->ira;
+  r = priv_->r;
+  s_w = priv_->s_w;
+  memcpy (x, priv_->x, sizeof (x));
+  memcpy (dx, priv_->dx, sizeof (dx));
+
+  SPNR_STATS_TIC (t);
+  for (;;)
+    {
+      /* closed: move both defects to a random site */
+      if (r == 0)
+        {
+          ira = k = spnr_rng_int (N);
+          for (d = 0; d < D; ++d, k /= L)
+            x[d] = k % L;
+        }
+
+      /* ira to its left (s < D) or right neighbor along d; the high
+       * bits of u pick the move, the low ones accept it */
+      u = spnr_rng_next ();
+      s = ((u >> 32) * (2 * D)) >> 32;
+      d = s < D ? s : s - D;
+      unit = priv_->unit[d];
+      if (s < D)
+        {
+          nbr = x[d] ? ira - unit : ira + (L - 1) * unit;
+          b = ira * D + d;
+        }
+      else
+        {
+          nbr = x[d] < L - 1 ? ira + unit : ira - (L - 1) * unit;
+          b = nbr * D + d;
+        }
+      SPNR_STATS_LAP (t, SPNR_PHASE_PROP);
+
+      if ((occ[b / 64] >> (b % 64)) & 1)
+        s_w -= w[b];
+      else if ((u & 0xffffff) * 0x1p-24f < tb[b])
+        s_w += w[b];
+      else
+        b = SIZE_MAX;
+
+      if (b != SIZE_MAX)
+        {
+          occ[b / 64] ^= (uint64_t) 1 << (b % 64);
+          ira = nbr;
+          if (s < D)
+            {
+              x[d] = x[d] ? x[d] - 1 : L - 1;
+              r = dx[d] ? r - unit : r + (L - 1) * unit;
+              dx[d] = dx[d] ? dx[d] - 1 : L - 1;
+            }
+          else
+            {
+              x[d] = x[d] < L - 1 ? x[d] + 1 : 0;
+              r = dx[d] < L - 1 ? r + unit : r - (L - 1) * unit;
+              dx[d] = dx[d] < L - 1 ? dx[d] + 1 : 0;
+            }
+          ++n_acc;
+        }
+      SPNR_STATS_LAP (t, SPNR_PHASE_ACCEPT);
+
+      ++g[r];
+      ++n;
+      if (r == 0)
+        {
+          e_sum += s_w;
+          ++n_z;
+          if (n_worms ? n_z == n_worms : n >= N)
+            break;
+        }
+    }
+
+  priv_->ira = ira;
+  priv_->r = r;
+  priv_->s_w = s_w;
+  memcpy (priv_->x, x, sizeof (x));
+  memcpy (priv_->dx, dx, sizeof (dx));
+  priv_->e_sum += e_sum;
+  priv_->n_updates += n;
+  priv_->n_all += n;
+  priv_->n_all_z += n_z;
+
+  write_spins (priv_, sys);
+
+  priv_->acc_rate = (float) n_acc / n;
+  SPNR_STATS_ADD (n_prop, n);
+  SPNR_STATS_ADD (n_acc, n_acc);
+}
+
+static float
+acc_rate (void const * const priv)
+{
+  return ((worm_priv_t const *) priv)->acc_rate;
+}
+
+static const spnr_step_kind_t worm_kind =
+{
+  "worm",
+  &priv_alloc,
+  &priv_free,
+  &apply,
+  &acc_rate
+};
+
+const spnr_step_kind_t *spnr_worm = &worm_kind;
+
+static worm_priv_t *
+worm_priv (spnr_step_t const * const step)
+{
+  if (step->kind != spnr_worm)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "stepper is not a worm stepper");
+  if (!((worm_priv_t *) step->priv)->sys)
+    spnr_err (SPNR_ERROR_PARAM_OOB, "worm stepper was never applied");
+  return (worm_priv_t *) step->priv;
+}
+
+void
+spnr_worm_reset (spnr_step_t * const step)
+{
+  obs_reset (worm_priv (step));
+}
+
+/* sum_r G(r), i.e. N <m^2> */
+double
+spnr_worm_chi (spnr_step_t const * const step)
+{
+  worm_priv_t const * const priv = worm_priv (step);
+  return (double) priv->n_updates / priv->g[0];
+}
+
+void
+spnr_worm_calc_g (spnr_step_t const * const step, double * const g)
+{
+  worm_priv_t const * const priv = worm_priv (step);
+  size_t r;
+
+  for (r = 0; r < priv->N; ++r)
+    g[r] = (double) priv->g[r] / priv->g[0];
+}
+
+/* second moment correlation length, from S(k) = sum_r G(r) cos (k . r)
+ * at the D smallest wave vectors */
+double
+spnr_worm_xi (spnr_step_t const * const step)
+{
+  worm_priv_t const * const priv = worm_priv (step);
+  size_t r, d;
+  double s_k = 0;
+
+  for (r = 0; r < priv->N; ++r)
+    for (d = 0; d < priv->D; ++d)
+      s_k += priv->g[r] * cos (2 * SPNR_PI * (r / priv->unit[d] % priv->L)
+                               / priv->L);
+  s_k /= (double) priv->g[0] * priv->D;
+
+  return sqrt (spnr_worm_chi (step) / s_k - 1)
+    / (2 * sin (SPNR_PI / priv->L));
+}
+
+/* - d ln Z / d beta per site: each bond gives J t, and J (1 / t - t)
+ * more when occupied */
+double
+spnr_worm_energy (spnr_step_t const * const step)
+{
+  worm_priv_t const * const priv = worm_priv (step);
+  return - (priv->jt + priv->e_sum / priv->g[0]) / priv->N;
+}